@@ -0,0 +1,51 @@
+#ifndef ENCODING_H
+#define ENCODING_H
+
+#include "json.hpp"
+#include "public.hpp"
+#include <string>
+
+/*
+payload encoding public to server and client
+*/
+
+// check whether the encoding is supported
+inline bool isValidEncoding(int encoding)
+{
+	return encoding >= JSON_ENCODING && encoding < WIRE_ENCODING_COUNT;
+}
+
+// serialize a message with the given encoding
+inline std::string encodeMessage(const nlohmann::json &js, int encoding)
+{
+	std::string out;
+	switch (encoding)
+	{
+	case CBOR_ENCODING:
+		nlohmann::json::to_cbor(js, out);
+		break;
+	case MSGPACK_ENCODING:
+		nlohmann::json::to_msgpack(js, out);
+		break;
+	default:
+		out = js.dump();
+		break;
+	}
+	return out;
+}
+
+// deserialize a message in [first, last), return a discarded value on failure
+inline nlohmann::json decodeMessage(const char *first, const char *last, int encoding)
+{
+	switch (encoding)
+	{
+	case CBOR_ENCODING:
+		return nlohmann::json::from_cbor(first, last, true, false);
+	case MSGPACK_ENCODING:
+		return nlohmann::json::from_msgpack(first, last, true, false);
+	default:
+		return nlohmann::json::parse(first, last, nullptr, false);
+	}
+}
+
+#endif
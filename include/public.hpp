@@ -17,5 +17,31 @@ enum EnMsgType
 	CREATE_GROUP_MSG,	// create group msg
 	ADD_GROUP_MSG,		// add group msg
 	GROUP_CHAT_MSG,		// group chat msg
+	HEARTBEAT_MSG,		// client heartbeat, keeps an idle connection alive
+	OFFLINE_MSG,		// page of offline messages, sent after the login ack
+	OFFLINE_MSG_ACK,	// client received the last page, "cursor" matters for group pages only
+
+	MSG_TYPE_COUNT,		// number of msg types, keep it last
+};
+
+// payload encoding of a connection, a client selects it with the
+// "encoding" field of LOGIN_MSG, every connection starts with JSON_ENCODING
+enum EnWireEncoding
+{
+	JSON_ENCODING = 0,	// json text
+	CBOR_ENCODING,		// cbor binary
+	MSGPACK_ENCODING,	// messagepack binary
+
+	WIRE_ENCODING_COUNT,	// number of encodings, keep it last
 };
+
+// seconds between two client heartbeats, keep it well below the server idle timeout
+const int HEARTBEAT_INTERVAL = 20;
+
+// every message on the wire is framed as [int32 length in network order][payload]
+const int FRAME_HEADER_LEN = 4;
+
+// upper bound of a single frame payload
+const int MAX_FRAME_LEN = 16 * 1024 * 1024;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,86 @@
+#ifndef CHATCODEC_H
+#define CHATCODEC_H
+
+#include <muduo/net/TcpConnection.h>
+#include <muduo/net/Buffer.h>
+#include <array>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "json.hpp"
+#include "public.hpp"
+
+using json = nlohmann::json;
+using muduo::net::TcpConnectionPtr;
+using muduo::net::Buffer;
+using muduo::Timestamp;
+
+// immutable encoded payload shared by every frame that carries it
+using PayloadPtr = std::shared_ptr<const std::string>;
+
+// one outbound message fanned out to many receivers, it is serialized at
+// most once per encoding and every receiver shares the encoded bytes
+class SharedPayload
+{
+public:
+	// message built by the server, js must outlive the payload
+	explicit SharedPayload(const json &js);
+
+	// json text received from redis, parsed only if a binary encoding needs it
+	explicit SharedPayload(std::string text);
+
+	SharedPayload(const SharedPayload &) = delete;
+	SharedPayload &operator=(const SharedPayload &) = delete;
+
+	// payload in the given encoding, nullptr if the text is not valid json
+	const PayloadPtr &encoded(int encoding);
+
+	// json text for redis and offline storage
+	const std::string &text() { return *encoded(JSON_ENCODING); }
+
+private:
+	// message to encode, nullptr until parsed from the text
+	const json *_js;
+
+	// owns the message parsed from the text
+	json _parsed;
+
+	std::array<PayloadPtr, WIRE_ENCODING_COUNT> _encoded;
+};
+
+// length header codec, every frame is [int32 length][payload], the payload
+// is encoded with the encoding negotiated by the connection's session
+class ChatCodec
+{
+public:
+	// callback to report one decoded message
+	using JsonMessageCallback = std::function<void(const TcpConnectionPtr &,
+												   json &,
+												   Timestamp)>;
+
+	explicit ChatCodec(const JsonMessageCallback &cb);
+
+	// decode every complete frame in place, partial frame stays in the buffer
+	void onMessage(const TcpConnectionPtr &conn,
+				   Buffer *buf,
+				   Timestamp receiveTime);
+
+	// encode the message for the connection, add length header and send it
+	static void send(const TcpConnectionPtr &conn, const json &js);
+
+	// add length header and send an already encoded payload, frames sent to a
+	// connection during one loop iteration are coalesced into a single write
+	static void send(const TcpConnectionPtr &conn, std::string payload);
+
+	// send a payload shared with other receivers without copying it
+	static void send(const TcpConnectionPtr &conn, const PayloadPtr &payload);
+
+private:
+	// queue one frame into the connection's outbox, runs in its io loop
+	static void appendInLoop(const TcpConnectionPtr &conn, const std::string &payload);
+
+	JsonMessageCallback _messageCallback;
+};
+
+#endif
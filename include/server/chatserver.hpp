@@ -3,7 +3,14 @@
 
 #include <muduo/net/TcpServer.h>
 #include <muduo/net/EventLoop.h>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+
+#include "chatcodec.hpp"
+#include "serverconfig.hpp"
+#include "timingwheel.hpp"
 
 using muduo::net::TcpServer;
 using muduo::net::EventLoop;
@@ -15,23 +22,39 @@ using muduo::Timestamp;
 // class ChatServer
 class ChatServer {
 public:
-	// initialize the server
+	// initialize the server, threadNum io threads serve the accepted connections
 	ChatServer(EventLoop* loop,
 				const InetAddress& listenAddr,
-				const std::string& nameArg);
+				const std::string& nameArg,
+				const ServerConfig& config,
+				int threadNum,
+				TcpServer::Option option = TcpServer::kNoReusePort);
 	// start service
 	void start();
 private:
 	// callback to report connection info
 	void onConnection(const TcpConnectionPtr&);
 
-	// callback to report message
+	// callback run by every io thread when it starts
+	void onThreadInit(EventLoop*);
+
+	// pin the calling io thread to the next cpu
+	void pinThread();
+
+	// callback to report one decoded message
 	void onMessage(const TcpConnectionPtr&,
-				Buffer*,
+				json&,
 				Timestamp);
 
+	// idle detectors of the io loops, declared before _server so that the
+	// io threads are joined before the wheels go away
+	std::vector<std::unique_ptr<TimingWheel>> _wheels;
+	std::mutex _wheelMutex;
+
 	TcpServer _server;
-	EventLoop *_loop; 
+	ChatCodec _codec;
+	EventLoop *_loop;
+	ServerConfig _config;
 };
 
 #endif
\ No newline at end of file
@@ -2,23 +2,50 @@
 #define CHATSERVICE_H
 
 #include <muduo/net/TcpConnection.h>
-#include <unordered_map>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/EventLoopThreadPool.h>
+#include <atomic>
+#include <cstdint>
 #include <functional>
-#include <mutex>
+#include <memory>
+#include <shared_mutex>
+#include <vector>
 
 #include "usermodel.hpp"
 #include "offlinemessagemodel.hpp"
 #include "friendmodel.hpp"
 #include "groupmodel.hpp"
+#include "loginmodel.hpp"
 #include "json.hpp"
 #include "redis.hpp"
+#include "chatcodec.hpp"
+#include "serverconfig.hpp"
+#include "shardedmap.hpp"
+#include "presencecache.hpp"
+#include "offlinebatcher.hpp"
+#include "session.hpp"
 
 using json = nlohmann::json;
 using muduo::Timestamp;
 using muduo::net::TcpConnectionPtr;
+using muduo::net::EventLoop;
+using muduo::net::EventLoopThreadPool;
 
-// type of message callback function
-using MsgHandler = std::function<void(const TcpConnectionPtr &conn, json &js, Timestamp)>;
+class ChatService;
+
+// counters of the receiver backpressure
+struct BackpressureStats
+{
+	// times a receiver crossed the high water mark
+	std::atomic<uint64_t> highWaterMark{0};
+	// messages stored offline because the receiver was congested
+	std::atomic<uint64_t> spilled{0};
+	// connections closed for being too slow
+	std::atomic<uint64_t> closed{0};
+};
+
+// type of message handler, a member function of ChatService
+using MsgHandler = void (ChatService::*)(const TcpConnectionPtr &conn, json &js, Timestamp);
 
 class ChatService
 {
@@ -39,39 +66,148 @@ public:
 	void addGroup(const TcpConnectionPtr &conn, json &js, Timestamp time);
 	// group chat
 	void groupChat(const TcpConnectionPtr &conn, json &js, Timestamp time);
+	// client acked offline messages
+	void offlineAck(const TcpConnectionPtr &conn, json &js, Timestamp time);
 	// logout
 	void logout(const TcpConnectionPtr &conn, json &js, Timestamp time);
-	// obtain msg handler
-	MsgHandler getHandler(int msgid);
+	// call the handler of msgid
+	void dispatch(int msgid, const TcpConnectionPtr &conn, json &js, Timestamp time);
+	// start the business worker threads, without them handlers run on the io threads
+	void startWorkers(EventLoop *baseLoop, int threadNum);
+	// run the task on the worker owning the connection, tasks of one connection keep their order
+	void runInWorker(const TcpConnectionPtr &conn, std::function<void()> task);
+	// set what happens to receivers above the high water mark
+	void setBackpressurePolicy(BackpressurePolicy policy);
+	// output buffer of the connection crossed the high water mark
+	void onHighWaterMark(const TcpConnectionPtr &conn, size_t len);
+	// output buffer of the connection drained
+	void onWriteComplete(const TcpConnectionPtr &conn);
+	// name of this server in the route table, and seconds a route lives without refresh
+	void setNode(const std::string &node, int routeTtl);
+	// extend the routes of every user logged in here
+	void refreshRoutes();
+	// offline messages written together in one multi-row INSERT
+	void setOfflineBatchRows(int maxRows);
+	// write the pending offline messages, a timer bounds how long they wait
+	void flushOffline();
+	// offline messages per page sent to a client
+	void setOfflinePageSize(int size);
+	// seconds a cached presence of a remote user stays valid, 0 disables the cache
+	void setPresenceTtl(int seconds);
+	// log the backpressure counters and drop expired presence entries
+	void reportStats();
 	// handle client close exception
 	void clientCloseException(const TcpConnectionPtr &conn);
-	// server error, reset client data
+	// server shutdown, finish the queued work, store the queued writes,
+	// stop the workers and reset client data; called from the main thread
+	// once its loop stopped and the connections were closed
 	void reset();
-	// handle redis subscribe message
-	void handleRedisSubscribeMessage(int, std::string);
+	// handle a message another server routed to users on this one
+	void handleRedisSubscribeMessage(std::vector<int> userids, std::string msg);
+	// handle presence change published by another server
+	void handlePresenceMessage(int userid, std::string node);
 private:
 	ChatService();
 
-	// store msg id and corresponding handler
-	std::unordered_map<int, MsgHandler> _msgHandlerMap;
+	// second step of login once the user row is loaded
+	void checkLogin(const TcpConnectionPtr &conn, const std::string &pwd, User &user);
+
+	// last step of login, reply with the loaded data
+	static void sendLoginAck(const TcpConnectionPtr &conn, const User &user, LoginSnapshot &snapshot);
+
+	// the output buffer drained, page what was spilled meanwhile
+	void sendSpilled(const TcpConnectionPtr &conn);
+
+	// read the first page of personal offline messages behind the queued rows
+	void loadOfflinePage(const TcpConnectionPtr &conn, int userid);
+
+	// send a page of personal offline messages, or end the paging when it is empty
+	void continueOfflinePage(const TcpConnectionPtr &conn, Session &session, const OfflinePage &page);
+
+	// send a page of offline messages, the client acks it to get the next one,
+	// groupid is set for the unread messages of a group; return the ids sent
+	static std::vector<int> sendOfflinePage(const TcpConnectionPtr &conn, const OfflinePage &page, int groupid = -1);
+
+	// load and send the unread messages of a group after cursor up to bound
+	void queryGroupPage(const TcpConnectionPtr &conn, int userid, int groupid, int cursor, int bound);
+
+	// after the login ack, look for groups with unread messages and page them
+	void loadPendingGroups(const TcpConnectionPtr &conn, int userid);
+
+	// user goes offline, the logged group messages count as received
+	void markGroupsRead(int userid, Session &session);
+
+	// wait until every worker ran the tasks queued so far, for shutdown
+	void drainWorkers();
+
+	// forward a group message to its members once they are loaded
+	void fanOut(const json &js, const std::vector<int> &useridVec);
+
+	// store a message for an offline user on the db loops
+	void storeOffline(int userid, const std::string &msg);
+
+	// forward a message to a user connected to this server, or store it
+	// offline while the user's connection is congested
+	void deliver(int userid, const TcpConnectionPtr &conn, SharedPayload &payload);
 
-	// store online user connection
-	std::unordered_map<int, TcpConnectionPtr> _userConnMap;
+	// node of a user not connected here, from the cache or the route table,
+	// false if the user is offline
+	bool findNode(int userid, std::string &node);
 
-	// mutex for _userConnMap
-	std::mutex _connMutex;
+	// publish a message to users on another node with one PUBLISH, false
+	// when the node does not listen any more
+	bool forwardRemote(const std::vector<int> &userids, const std::string &node, SharedPayload &payload);
+
+	// user went online or offline on this server
+	void setLocalPresence(int userid, bool online);
+
+	// store online user connection, sharded so threads rarely contend
+	ShardedMap<int, TcpConnectionPtr> _userConnMap;
+
+	// name of this server in the route table
+	std::string _node;
+
+	// seconds a route lives without refresh
+	int _routeTtl = 60;
+
+	// offline messages per page
+	int _offlinePageSize = 100;
+
+	// online state of users, avoids a Users.state read per message
+	PresenceCache _presence;
+
+	// business worker loops, every connection is bound to one of them
+	std::unique_ptr<EventLoopThreadPool> _workers;
+	std::vector<EventLoop *> _workerLoops;
+
+	// policy for receivers above the high water mark
+	BackpressurePolicy _backpressure = SPILL_TO_OFFLINE;
+
+	// backpressure counters
+	BackpressureStats _stats;
 
 	// offline message model
 	OfflineMsgModel _offlineMsgModel;
 
+	// group data model
+	GroupModel _groupModel;
+
+	// write-behind queue of offline messages and group log messages
+	OfflineBatcher _offlineBatcher;
+
+	// shared by fan-outs around their registry snapshot and group log add,
+	// exclusive while a login registers, so a fan-out that missed the user
+	// has queued its log row before the login looks for unread groups
+	std::shared_mutex _registerMutex;
+
 	// user data access object
 	UserModel _userModel;
 
 	// friend data model
 	FriendModel _friendModel;
 
-	// group data model
-	GroupModel _groupModel;
+	// login snapshot model
+	LoginModel _loginModel;
 
 	// redis instance
 	Redis _redis;
@@ -2,10 +2,153 @@
 #define DB_H
 
 #include <mysql/mysql.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
+struct Connection;
 
-// mysql class
+// prepared statement, parsed by the server once and executed with binary
+// parameters and results, owned by the connection it was prepared on
+class Statement
+{
+public:
+	Statement(Connection *conn, MYSQL_STMT *stmt);
+
+	~Statement();
+
+	Statement(const Statement &) = delete;
+	Statement &operator=(const Statement &) = delete;
+
+	// append the next parameter, values are copied until execute
+	Statement &param(int value);
+	Statement &param(const std::string &value);
+
+	// run with the appended parameters and clear them, results are
+	// buffered on the client and read with fetch
+	bool execute();
+
+	// move to the next result row, false after the last one
+	bool fetch();
+
+	// column of the current row, NULL reads as 0 or ""
+	int getInt(unsigned int column) const;
+	std::string getString(unsigned int column) const;
+
+	// id generated by the last INSERT
+	my_ulonglong insertId();
+
+private:
+	// bool in mysql 8, my_bool before
+	using Flag = std::remove_pointer<decltype(MYSQL_BIND().is_null)>::type;
+
+	struct Param
+	{
+		bool isInt;
+		long long intValue;
+		std::string text;
+		unsigned long length;
+	};
+
+	struct Column
+	{
+		bool isInt;
+		long long intValue;
+		std::vector<char> buffer;
+		unsigned long length;
+		Flag isNull;
+		Flag error;
+	};
+
+	// set up the result buffers from the result metadata
+	bool bindResult();
+
+	// log the error, a lost connection is marked broken
+	void fail(const char *what);
+
+	Connection *_conn;
+	MYSQL_STMT *_stmt;
+	std::vector<Param> _params;
+	std::vector<Column> _columns;
+	std::vector<MYSQL_BIND> _resultBinds;
+};
+
+// open mysql connection and the statements prepared on it
+struct Connection
+{
+	explicit Connection(MYSQL *mysql);
+	~Connection();
+
+	MYSQL *mysql;
+
+	// lost the server, closed instead of returned to the pool
+	bool broken;
+
+	// mark broken if err means the server is gone
+	void checkError(unsigned int err);
+
+	// sql text => prepared statement
+	std::unordered_map<std::string, std::unique_ptr<Statement>> statements;
+};
+
+// thread safe pool of open mysql connections shared by all models,
+// a checkout costs a lock instead of a tcp + auth handshake
+class ConnectionPool
+{
+public:
+	// get the singleton instance
+	static ConnectionPool *instance();
+
+	// open minSize connections now, never hold more than maxSize,
+	// close idle connections above minSize after idleTimeout seconds
+	void init(size_t minSize, size_t maxSize, int idleTimeout);
+
+	// take an idle connection or open a new one, waits while maxSize
+	// connections are checked out, nullptr on failure or timeout
+	std::unique_ptr<Connection> acquire();
+
+	// give a connection back, broken connections are closed
+	void release(std::unique_ptr<Connection> conn);
+
+	// close connections idle for longer than the idle timeout, return how many
+	size_t evictIdle();
+
+private:
+	struct IdleConnection
+	{
+		std::unique_ptr<Connection> conn;
+		std::chrono::steady_clock::time_point since;
+	};
+
+	ConnectionPool() = default;
+
+	// open and configure a new connection, nullptr on failure
+	static std::unique_ptr<Connection> open();
+
+	std::mutex _mutex;
+	std::condition_variable _available;
+
+	// idle connections, the most recently used at the back
+	std::vector<IdleConnection> _idle;
+
+	// connections idle, checked out or being opened
+	size_t _total = 0;
+
+	size_t _minSize = 2;
+	size_t _maxSize = 16;
+	std::chrono::seconds _idleTimeout{300};
+};
+
+// mysql class, checks a connection out of the pool on connect and
+// returns it on destruction
 class MySQL
 {
 public:
@@ -13,6 +156,9 @@ public:
 
 	~MySQL();
 
+	MySQL(const MySQL &) = delete;
+	MySQL &operator=(const MySQL &) = delete;
+
 	// connect to mysql
 	bool connect();
 
@@ -22,11 +168,26 @@ public:
 	// query method, return some result
 	MYSQL_RES *query(std::string sql);
 
+	// run several ';' separated statements in one round trip, the result sets
+	// of the statements returning rows are appended to results in order and
+	// must be freed by the caller, false and nothing appended on failure
+	bool queryMulti(const std::string &sql, std::vector<MYSQL_RES *> &results);
+
+	// prepared statement for sql, cached on the connection so the server
+	// parses it once per connection, nullptr on failure
+	Statement *prepare(const std::string &sql);
+
+	// insert count rows with multi-row INSERTs, sql inserts one row and ends
+	// with its "(?, ...)" tuple, bind(stmt, i) appends the parameters of row i;
+	// ids follow the row order, false if a chunk failed
+	bool insertRows(const std::string &sql, size_t count,
+					const std::function<void(Statement &, size_t)> &bind);
+
 	// get connection
 	MYSQL *getConnection();
 
 private:
-	MYSQL *_conn;
+	std::unique_ptr<Connection> _conn;
 };
 
-#endif
\ No newline at end of file
+#endif
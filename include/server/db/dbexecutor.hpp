@@ -0,0 +1,60 @@
+#ifndef DBEXECUTOR_H
+#define DBEXECUTOR_H
+
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/EventLoopThreadPool.h>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+using muduo::net::EventLoop;
+using muduo::net::EventLoopThreadPool;
+
+// dedicated db loops running the blocking mysql calls, so the threads
+// handling messages never wait for a round trip; the caller continues in
+// a completion callback queued back to its own loop
+// tasks with the same key run on the same db loop in submission order
+class DbExecutor
+{
+public:
+	// get the singleton instance
+	static DbExecutor *instance();
+
+	// start the db loops, without them every query runs inline in the caller
+	void start(EventLoop *baseLoop, int threadNum);
+
+	// run query on the db loop owning key, then done(result) in the calling loop,
+	// or in the db loop when the caller is not in an event loop
+	template <typename Query, typename Done>
+	void submit(size_t key, Query query, Done done)
+	{
+		EventLoop *caller = EventLoop::getEventLoopOfCurrentThread();
+		run(key, [caller, query = std::move(query), done = std::move(done)]() mutable
+			{
+				auto result = std::make_shared<decltype(query())>(query());
+				if (caller == nullptr || caller->isInLoopThread())
+				{
+					done(std::move(*result));
+					return;
+				}
+				caller->queueInLoop([done = std::move(done), result]() mutable
+									{ done(std::move(*result)); });
+			});
+	}
+
+	// run a task on the db loop owning key, nobody waits for it
+	void run(size_t key, std::function<void()> task);
+
+	// wait until every db loop ran the tasks queued so far, for shutdown
+	void drain();
+
+private:
+	DbExecutor() = default;
+
+	std::unique_ptr<EventLoopThreadPool> _loops;
+	// cached at start, getLoopForHash may only be called on the base loop
+	std::vector<EventLoop *> _loopList;
+};
+
+#endif
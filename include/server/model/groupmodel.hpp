@@ -2,23 +2,62 @@
 #define GROUPMODEL_H
 
 #include "group.hpp"
+#include "offlinemessagemodel.hpp"
 #include <string>
 #include <vector>
 
+// a message of the group log
+struct GroupLogRow
+{
+	int groupid;
+	int userid;
+	std::string msg;
+};
+
+// rows of a batched insert into the group log
+using GroupLogBatch = std::vector<GroupLogRow>;
+
+// a group with unread messages, paged from cursor up to bound, the last
+// message logged before the lookup; later ones are delivered live
+struct PendingGroup
+{
+	int groupid;
+	int cursor;
+	int bound;
+};
+
+// group messages are stored once in GroupMessage(id INT AUTO_INCREMENT PRIMARY KEY,
+// groupid INT, userid INT, message TEXT, INDEX(groupid, id)) and every member
+// keeps GroupUser.lastread, the id of the last message of the group it has
+// received; members get the messages after their cursor at login
 class GroupModel
 {
 public:
 	// create group
 	bool createGroup(Group &group);
 
-	// join a group
+	// join a group, the messages sent before joining count as read
 	void addGroup(int userid, int groupid, std::string role);
 
-	// query user's group
-	std::vector<Group> queryGroups(int userid);
-
 	// query list of user ids in a group
 	std::vector<int> queryGroupUsers(int userid, int groupid);
+
+	// append messages to the group log with multi-row INSERTs, ids follow the batch order
+	void insertMessages(const GroupLogBatch &batch);
+
+	// groups of userid with messages of others after the read cursor
+	std::vector<PendingGroup> queryPending(int userid);
+
+	// at most limit messages of a group after cursor up to bound, not sent
+	// by userid, empty unless userid is a member
+	OfflinePage queryMessages(int userid, int groupid, int cursor, int bound, int limit);
+
+	// the user received the messages of groupid up to cursor
+	void ackMessages(int userid, int groupid, int cursor);
+
+	// the user received every logged message of its groups except those in
+	// skipGroups, called when the user goes offline
+	void markRead(int userid, const std::vector<int> &skipGroups);
 };
 
 #endif
@@ -0,0 +1,24 @@
+#ifndef LOGINMODEL_H
+#define LOGINMODEL_H
+
+#include "user.hpp"
+#include "group.hpp"
+#include <string>
+#include <vector>
+
+// data of the login ack
+struct LoginSnapshot
+{
+	std::vector<User> friends;
+	std::vector<Group> groups;
+};
+
+// everything a login needs besides the user row, read in one round trip
+class LoginModel
+{
+public:
+	// mark the user online, read the friends, groups and their members
+	bool load(int userid, LoginSnapshot &snapshot);
+};
+
+#endif
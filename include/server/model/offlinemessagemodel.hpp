@@ -2,19 +2,29 @@
 #define OFFLINEMESSAGEMODEL_H
 
 #include <string>
+#include <utility>
 #include <vector>
 
+// offline message id => message text, in id order
+using OfflinePage = std::vector<std::pair<int, std::string>>;
+
+// receiver id => message text, rows of a batched insert
+using OfflineBatch = std::vector<std::pair<int, std::string>>;
+
+// OfflineMessage(id INT AUTO_INCREMENT PRIMARY KEY, userid INT, message TEXT),
+// the id orders the messages of a user; rows are deleted by id once acked,
+// never by range, since ids of concurrent writers are not committed in order
 class OfflineMsgModel
 {
 public:
-	// store offline message
-	void insert(int userid, std::string msg);
+	// store many offline messages with multi-row INSERTs, ids follow the batch order
+	void insert(const OfflineBatch &batch);
 
-	// delete offline message
-	void remove(int userid);
+	// delete the offline messages of userid with the given ids
+	void remove(int userid, const std::vector<int> &ids);
 
-	// query offline message
-	std::vector<std::string> query(int userid);
+	// query at most limit offline messages after cursor
+	OfflinePage query(int userid, int cursor, int limit);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,66 @@
+#ifndef OFFLINEBATCHER_H
+#define OFFLINEBATCHER_H
+
+#include "offlinemessagemodel.hpp"
+#include "groupmodel.hpp"
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+// write-behind queue of offline messages and group log messages, pending
+// rows are written with multi-row INSERTs once maxRows rows or 1 MiB are
+// pending, or when the server timer calls flush; a crash loses at most the
+// pending rows
+// all rows go through one db loop, so they are stored in the order added
+class OfflineBatcher
+{
+public:
+	// db executor key of the offline writes, one loop keeps them in order,
+	// a task queued on it after flush runs after every row added before
+	static const size_t kWriterKey = 0;
+
+	OfflineBatcher(OfflineMsgModel &offlineModel, GroupModel &groupModel);
+
+	// maxRows 1 writes every message on its own
+	void setMaxRows(int maxRows);
+
+	// queue a message for an offline user
+	void add(int userid, const std::string &msg);
+
+	// queue a message of userid for the log of groupid
+	void addGroupMessage(int groupid, int userid, const std::string &msg);
+
+	// hand the pending rows to the db loop
+	void flush();
+
+private:
+	// rows cut together and written by one task
+	struct Batch
+	{
+		OfflineBatch offline;
+		GroupLogBatch group;
+	};
+
+	// cut a batch once it is big enough, called with _mutex held through lock
+	void writeIfFull(std::unique_lock<std::mutex> &lock);
+
+	// take the pending rows, called with _mutex held
+	Batch takePending();
+
+	// write a batch on the db loop, called with _mutex held through lock,
+	// which is released before the rows go out
+	void write(Batch batch, std::unique_lock<std::mutex> &lock);
+
+	OfflineMsgModel &_offlineModel;
+	GroupModel &_groupModel;
+
+	std::mutex _mutex;
+	// taken before _mutex is released, batches go out in the order they were cut
+	std::mutex _writeMutex;
+	Batch _pending;
+	size_t _pendingBytes = 0;
+
+	size_t _maxRows = 256;
+};
+
+#endif
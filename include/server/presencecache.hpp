@@ -0,0 +1,85 @@
+#ifndef PRESENCECACHE_H
+#define PRESENCECACHE_H
+
+#include "shardedmap.hpp"
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/*
+in-process cache of the node every user is on, used to route messages
+without a redis or mysql read per message
+
+consistency rules:
+1. users logged in on this server are authoritative: login/logout/close
+   set them with setLocal(), they never expire, and notifications from
+   other servers never override them
+2. every other entry comes from a presence notification of another server
+   or from the redis route table, and expires after ttl seconds, which bounds the
+   staleness caused by a lost notification (redis pub/sub is at most once)
+3. a lookup that finds no fresh entry returns UNKNOWN, the caller takes
+   readVersion(), reads the route table and stores the answer with setRead()
+4. a caller that finds a cached ONLINE user unreachable corrects the entry
+   with setRead(userid, "", version) using the version taken before the publish
+5. every notification and local change gets a new version, the answer of a
+   read is dropped when the entry changed after the read started, so a
+   route table read racing a login elsewhere cannot overwrite its notification
+*/
+class PresenceCache
+{
+public:
+	enum State
+	{
+		UNKNOWN,
+		ONLINE,
+		OFFLINE,
+	};
+
+	explicit PresenceCache(int ttlSeconds = 30);
+
+	// seconds a remote entry stays valid
+	void setTtl(int ttlSeconds);
+
+	// user logged in or out on this server
+	void setLocal(int userid, bool online);
+
+	// node of a user notified by another server, an empty node means offline
+	void setRemote(int userid, const std::string &node);
+
+	// version to pass to setRead for a read starting now
+	uint64_t readVersion() const;
+
+	// node of a user read from the route table, ignored if the entry changed
+	// after readVersion() returned version
+	void setRead(int userid, const std::string &node, uint64_t version);
+
+	// cached state of the user, UNKNOWN if absent or expired,
+	// node is set for remote ONLINE users
+	State lookup(int userid, std::string &node) const;
+
+	// drop expired entries, return how many
+	size_t evictExpired();
+
+private:
+	struct Entry
+	{
+		bool online = false;
+		// node of a remote online user
+		std::string node;
+		// set by setLocal(true), cleared when the user leaves this server
+		bool local = false;
+		// steady clock microseconds, 0 means never valid
+		int64_t expireAt = 0;
+		// version of the last change, reads older than it are dropped
+		uint64_t version = 0;
+	};
+
+	// steady clock now in microseconds
+	static int64_t now();
+
+	std::atomic<int64_t> _ttl;
+	std::atomic<uint64_t> _version{0};
+	ShardedMap<int, Entry> _entries;
+};
+
+#endif
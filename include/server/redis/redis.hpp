@@ -4,6 +4,9 @@
 #include <hiredis/hiredis.h>
 #include <thread>
 #include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
 
 class Redis
 {
@@ -14,20 +17,40 @@ public:
 	// connect to redis server
 	bool connect();
 
-	// publish to a channel
-	bool publish(int channel, std::string message);
+	// publish to the channel of a server node, the subscriber hands message to
+	// every user in userids; return the number of subscribers that got it, -1 on error
+	int publishToNode(const std::string &node, const std::vector<int> &userids, const std::string &message);
 
-	// subscribe to a channel
-	bool subscribe(int channel);
+	// tell every server that a user is now on node, an empty node means offline
+	bool publishPresence(int userid, const std::string &node);
 
-	// unsubscribe from a channel
-	bool unsubscribe(int channel);
+	// route table "route:<userid>" => node, entries expire after ttl seconds
+	bool setRoute(int userid, const std::string &node, int ttl);
+
+	// extend the routes of users on node by ttl seconds in one round trip,
+	// a route now held by another node is left alone
+	bool refreshRoutes(const std::vector<int> &userids, const std::string &node, int ttl);
+
+	// remove the route of userid if it still points to node
+	bool removeRoute(int userid, const std::string &node);
+
+	// node of userid, empty if the user has no route, false on error
+	bool getRoute(int userid, std::string &node);
+
+	// nodes of many users with one MGET, nodes[i] belongs to userids[i]
+	bool getRoutes(const std::vector<int> &userids, std::vector<std::string> &nodes);
+
+	// subscribe to the channel of a server node
+	bool subscribeNode(const std::string &node);
 
 	// observer channel message
 	void observer_channel_message();
 
-	// set notify message handler
-	void init_notify_handler(std::function<void(int, std::string)> fn);
+	// set notify message handler, called with the receivers and the message
+	void init_notify_handler(std::function<void(std::vector<int>, std::string)> fn);
+
+	// set presence change handler, called with user id and node, empty when offline
+	void init_presence_handler(std::function<void(int, std::string)> fn);
 
 private:
 
@@ -35,6 +58,12 @@ private:
 
 	redisContext *_subscribe_context;
 
-	std::function<void(int, std::string)> _notify_message_handler;
+	// hiredis contexts are not thread safe, handlers call in from every worker
+	std::mutex _publish_mutex;
+	std::mutex _subscribe_mutex;
+
+	std::function<void(std::vector<int>, std::string)> _notify_message_handler;
+
+	std::function<void(int, std::string)> _presence_handler;
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,83 @@
+#ifndef SERVERCONFIG_H
+#define SERVERCONFIG_H
+
+#include <muduo/base/Logging.h>
+#include <cstdint>
+#include <string>
+
+// what to do with a receiver whose output buffer crosses the high water mark
+enum BackpressurePolicy
+{
+	SPILL_TO_OFFLINE,	// store further messages offline until the buffer drains, then page them
+						// to the receiver like the offline messages of a login
+	CLOSE_CONNECTION,	// drop the slow connection
+};
+
+// runtime configuration of ChatServer, parsed from the command line
+struct ServerConfig
+{
+	// listen address
+	std::string ip;
+	uint16_t port = 0;
+
+	// number of io threads in total, 0 means the accept loops do all io
+	int ioThreads = 4;
+
+	// pin every io thread to its own cpu
+	bool cpuAffinity = false;
+
+	// number of SO_REUSEPORT acceptors, each one owns a share of the io threads
+	int acceptors = 1;
+
+	// number of business worker threads running the handlers, 0 runs them on the io threads
+	int workerThreads = 4;
+
+	// seconds without any inbound message before a connection is closed, 0 disables
+	int idleTimeout = 60;
+
+	// per connection output buffer limit and the policy applied above it
+	int highWaterMark = 4 * 1024 * 1024;
+	BackpressurePolicy backpressure = SPILL_TO_OFFLINE;
+
+	// number of db loops running the mysql calls, 0 runs them in the calling thread
+	int dbThreads = 4;
+
+	// offline messages are written in batches of up to offlineBatch rows, a row waits
+	// at most offlineFlushMs; both bound what a crash loses, 1 writes every message at once
+	int offlineBatch = 256;
+	int offlineFlushMs = 50;
+
+	// offline messages sent per page, the client acks a page to get the next one
+	int offlinePageSize = 100;
+
+	// mysql connection pool bounds, and seconds an idle connection above the minimum is kept
+	int dbPoolMin = 2;
+	int dbPoolMax = 16;
+	int dbIdleTimeout = 300;
+
+	// minimum log level
+	muduo::Logger::LogLevel logLevel = muduo::Logger::INFO;
+
+	// basename of the async log file, empty means log to stdout
+	std::string logFile;
+
+	// roll the log file after this many bytes
+	int logRollSize = 500 * 1024 * 1024;
+
+	// name of this server in the redis route table, empty means "ip:port"
+	std::string nodeId;
+
+	// seconds a route survives without refresh, routes of a crashed server expire after it
+	int routeTtl = 60;
+
+	// seconds a cached presence of a user on another server stays valid
+	int presenceTtl = 30;
+
+	// log one inbound message out of every traceSample, 0 disables sampling
+	unsigned traceSample = 0;
+};
+
+// parse "ip port [options]", print usage and return false on error
+bool parseServerConfig(int argc, char **argv, ServerConfig &config);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <muduo/net/TcpConnection.h>
+#include <muduo/net/Buffer.h>
+#include <boost/any.hpp>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "public.hpp"
+#include "timingwheel.hpp"
+
+using muduo::net::TcpConnectionPtr;
+
+// per connection state, kept in the TcpConnection context
+struct Session
+{
+	// id of the user logged in on this connection, -1 before login
+	std::atomic<int> userid{-1};
+
+	// negotiated payload encoding
+	std::atomic<int> encoding{JSON_ENCODING};
+
+	// output buffer went above the high water mark and has not drained yet
+	std::atomic<bool> congested{false};
+
+	// frames queued during the current loop iteration, flushed with one write,
+	// only touched in the io loop of the connection
+	muduo::net::Buffer outbox;
+	bool flushPending = false;
+
+	// handle in the idle detector of the io loop
+	TimingWheel::WeakEntryPtr idleEntry;
+
+	// an offline page was sent and the chain of acks has not run dry yet, and
+	// the ids of the page in flight, deleted once the client acks it; ids are
+	// not committed in order across servers, so the ack deletes exactly these
+	// only touched by the handlers of the connection
+	bool offlinePaging = false;
+	std::vector<int> offlineSent;
+	// rows were spilled while a page was in flight, read them when it runs dry
+	bool spilledBehind = false;
+
+	// the unread groups of the user were looked up, until then logout leaves
+	// every read cursor alone; and the groups whose unread messages are still
+	// being paged to the client, group id => id of the last message to page;
+	// only touched by the handlers of the connection
+	bool groupsLoaded = false;
+	std::unordered_map<int, int> pendingGroups;
+};
+
+using SessionPtr = std::shared_ptr<Session>;
+
+// attach a new session to the connection
+inline SessionPtr createSession(const TcpConnectionPtr &conn)
+{
+	SessionPtr session = std::make_shared<Session>();
+	conn->setContext(session);
+	return session;
+}
+
+// get the session of the connection, nullptr if none was attached
+inline SessionPtr getSession(const TcpConnectionPtr &conn)
+{
+	const boost::any &context = conn->getContext();
+	if (context.empty())
+	{
+		return nullptr;
+	}
+	return boost::any_cast<SessionPtr>(context);
+}
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef SHARDEDMAP_H
+#define SHARDEDMAP_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// hash map split into independently locked shards, readers of a shard share
+// its lock, so lookups from different threads rarely wait for each other
+template <typename Key, typename Value, size_t ShardCount = 64, typename Hash = std::hash<Key>>
+class ShardedMap
+{
+public:
+	// insert a new entry, false if key is already present
+	bool insert(const Key &key, const Value &value)
+	{
+		Shard &shard = shardOf(key);
+		std::unique_lock<std::shared_mutex> lock(shard.mutex);
+		return shard.map.emplace(key, value).second;
+	}
+
+	// copy the value of key into value, false if key is absent
+	bool find(const Key &key, Value &value) const
+	{
+		const Shard &shard = shardOf(key);
+		std::shared_lock<std::shared_mutex> lock(shard.mutex);
+		auto it = shard.map.find(key);
+		if (it == shard.map.end())
+		{
+			return false;
+		}
+		value = it->second;
+		return true;
+	}
+
+	// snapshot many keys at once, every shard involved is locked once,
+	// present keys go to found with their value, absent ones to missing
+	void findAll(const std::vector<Key> &keys,
+				 std::vector<std::pair<Key, Value>> &found,
+				 std::vector<Key> &missing) const
+	{
+		// visit the keys shard by shard
+		std::vector<std::pair<size_t, Key>> order;
+		order.reserve(keys.size());
+		for (const Key &key : keys)
+		{
+			order.emplace_back(Hash()(key) % ShardCount, key);
+		}
+		std::sort(order.begin(), order.end(),
+				  [](const std::pair<size_t, Key> &a, const std::pair<size_t, Key> &b)
+				  { return a.first < b.first; });
+
+		size_t i = 0;
+		while (i < order.size())
+		{
+			const Shard &shard = _shards[order[i].first];
+			std::shared_lock<std::shared_mutex> lock(shard.mutex);
+			for (size_t shardIndex = order[i].first; i < order.size() && order[i].first == shardIndex; ++i)
+			{
+				auto it = shard.map.find(order[i].second);
+				if (it != shard.map.end())
+				{
+					found.emplace_back(it->first, it->second);
+				}
+				else
+				{
+					missing.push_back(order[i].second);
+				}
+			}
+		}
+	}
+
+	// snapshot of every key
+	std::vector<Key> keys() const
+	{
+		std::vector<Key> result;
+		for (const Shard &shard : _shards)
+		{
+			std::shared_lock<std::shared_mutex> lock(shard.mutex);
+			for (const auto &entry : shard.map)
+			{
+				result.push_back(entry.first);
+			}
+		}
+		return result;
+	}
+
+	// call func(value) under the shard lock, value is default constructed if key is absent
+	template <typename Func>
+	void update(const Key &key, Func func)
+	{
+		Shard &shard = shardOf(key);
+		std::unique_lock<std::shared_mutex> lock(shard.mutex);
+		func(shard.map[key]);
+	}
+
+	// remove key only while it still maps to expected, false otherwise
+	bool eraseIf(const Key &key, const Value &expected)
+	{
+		Shard &shard = shardOf(key);
+		std::unique_lock<std::shared_mutex> lock(shard.mutex);
+		auto it = shard.map.find(key);
+		if (it == shard.map.end() || !(it->second == expected))
+		{
+			return false;
+		}
+		shard.map.erase(it);
+		return true;
+	}
+
+	// remove every entry for which pred(key, value) holds, return how many
+	template <typename Pred>
+	size_t eraseAll(Pred pred)
+	{
+		size_t erased = 0;
+		for (Shard &shard : _shards)
+		{
+			std::unique_lock<std::shared_mutex> lock(shard.mutex);
+			for (auto it = shard.map.begin(); it != shard.map.end();)
+			{
+				if (pred(it->first, it->second))
+				{
+					it = shard.map.erase(it);
+					++erased;
+				}
+				else
+				{
+					++it;
+				}
+			}
+		}
+		return erased;
+	}
+
+private:
+	// one cache line per shard header, so shard locks do not false share
+	struct alignas(64) Shard
+	{
+		mutable std::shared_mutex mutex;
+		std::unordered_map<Key, Value, Hash> map;
+	};
+
+	Shard &shardOf(const Key &key)
+	{
+		return _shards[Hash()(key) % ShardCount];
+	}
+
+	const Shard &shardOf(const Key &key) const
+	{
+		return _shards[Hash()(key) % ShardCount];
+	}
+
+	std::array<Shard, ShardCount> _shards;
+};
+
+#endif
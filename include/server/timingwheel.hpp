@@ -0,0 +1,48 @@
+#ifndef TIMINGWHEEL_H
+#define TIMINGWHEEL_H
+
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/TcpConnection.h>
+#include <boost/circular_buffer.hpp>
+#include <memory>
+#include <unordered_set>
+
+using muduo::net::EventLoop;
+using muduo::net::TcpConnection;
+using muduo::net::TcpConnectionPtr;
+
+// idle connection detector of one io loop, a connection that receives nothing
+// for idleSeconds is closed, every tick costs O(1) besides the closed ones
+class TimingWheel
+{
+public:
+	// closes the connection when the last bucket holding it expires
+	struct Entry
+	{
+		explicit Entry(const TcpConnectionPtr &conn) : _conn(conn) {}
+		~Entry();
+
+		std::weak_ptr<TcpConnection> _conn;
+	};
+	using EntryPtr = std::shared_ptr<Entry>;
+	using WeakEntryPtr = std::weak_ptr<Entry>;
+
+	// must be created in the thread of loop
+	TimingWheel(EventLoop *loop, int idleSeconds);
+
+	// start watching a new connection, keep the returned handle for touch()
+	WeakEntryPtr add(const TcpConnectionPtr &conn);
+
+	// the connection received something, push its deadline back
+	void touch(const WeakEntryPtr &weakEntry);
+
+private:
+	// rotate the wheel by one second
+	void onTimer();
+
+	using Bucket = std::unordered_set<EntryPtr>;
+
+	boost::circular_buffer<Bucket> _buckets;
+};
+
+#endif
@@ -0,0 +1,52 @@
+-- schema of the chat database, for a new install:
+--   mysql -u root -p < sql/chat.sql
+-- an existing database is brought up to date with sql/migrate.sql
+
+CREATE DATABASE IF NOT EXISTS chat;
+USE chat;
+
+CREATE TABLE Users (
+	id INT AUTO_INCREMENT PRIMARY KEY,
+	name VARCHAR(50) NOT NULL UNIQUE,
+	password VARCHAR(50) NOT NULL,
+	state ENUM('online', 'offline') DEFAULT 'offline'
+);
+
+CREATE TABLE Friend (
+	userid INT NOT NULL,
+	friendid INT NOT NULL,
+	PRIMARY KEY (userid, friendid)
+);
+
+CREATE TABLE AllGroup (
+	id INT AUTO_INCREMENT PRIMARY KEY,
+	groupname VARCHAR(50) NOT NULL UNIQUE,
+	groupdesc VARCHAR(200) DEFAULT ''
+);
+
+CREATE TABLE GroupUser (
+	groupid INT NOT NULL,
+	userid INT NOT NULL,
+	grouprole ENUM('creater', 'normal') DEFAULT 'normal',
+	-- id of the last message of the group the member received
+	lastread INT NOT NULL DEFAULT 0,
+	PRIMARY KEY (groupid, userid),
+	INDEX (userid)
+);
+
+-- the id orders a user's messages and is the cursor of the offline pages
+CREATE TABLE OfflineMessage (
+	id INT AUTO_INCREMENT PRIMARY KEY,
+	userid INT NOT NULL,
+	message TEXT NOT NULL,
+	INDEX (userid, id)
+);
+
+-- every group message is stored once, members read it up to their lastread
+CREATE TABLE GroupMessage (
+	id INT AUTO_INCREMENT PRIMARY KEY,
+	groupid INT NOT NULL,
+	userid INT NOT NULL,
+	message TEXT NOT NULL,
+	INDEX (groupid, id)
+);
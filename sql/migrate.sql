@@ -0,0 +1,19 @@
+-- brings a chat database created before the offline message pages and the
+-- group log up to date:
+--   mysql -u root -p chat < sql/migrate.sql
+
+-- offline messages are paged and acked by id
+ALTER TABLE OfflineMessage ADD id INT AUTO_INCREMENT PRIMARY KEY FIRST;
+ALTER TABLE OfflineMessage MODIFY message TEXT NOT NULL;
+ALTER TABLE OfflineMessage ADD INDEX (userid, id);
+
+-- group messages are logged once with a read cursor per member, the history
+-- of existing groups counts as read
+CREATE TABLE GroupMessage (
+	id INT AUTO_INCREMENT PRIMARY KEY,
+	groupid INT NOT NULL,
+	userid INT NOT NULL,
+	message TEXT NOT NULL,
+	INDEX (groupid, id)
+);
+ALTER TABLE GroupUser ADD lastread INT NOT NULL DEFAULT 0;
@@ -5,7 +5,10 @@
 #include <string>
 #include <vector>
 #include <ctime>
+#include <cstring>
 #include <functional>
+#include <atomic>
+#include <mutex>
 #include <unordered_map>
 using json = nlohmann::json;
 
@@ -18,6 +21,7 @@ using json = nlohmann::json;
 #include "group.hpp"
 #include "user.hpp"
 #include "public.hpp"
+#include "encoding.hpp"
 
 // record current user info
 User g_currentUser;
@@ -37,12 +41,33 @@ bool isMainMenuRunning = false;
 // receive thread
 void readTaskHandler(int clientfd);
 
+// print a one chat or group chat message
+void showChatMessage(const json &js);
+
 // obtain current time
 std::string getCurrentTime();
 
 // main menu of the chat client
 void mainMenu(int clientfd);
 
+// payload encoding currently used on the connection
+std::atomic<int> g_encoding{JSON_ENCODING};
+
+// serializes frames written by the menu and the heartbeat thread
+std::mutex g_sendMutex;
+
+// heartbeat thread
+void heartbeatTaskHandler(int clientfd);
+
+// payload encoding requested at login
+int g_loginEncoding = JSON_ENCODING;
+
+// encode and send one length prefixed message
+int sendMsg(int clientfd, const json &js);
+
+// receive and decode one length prefixed message, false on error or peer close
+bool recvMsg(int clientfd, json &js);
+
 // send thread
 int main(int argc, char **argv)
 {
@@ -63,6 +88,24 @@ int main(int argc, char **argv)
 		port = atoi(argv[2]);
 	}
 
+	// optional payload encoding: json, cbor or msgpack
+	if (argc >= 4)
+	{
+		std::string encoding = argv[3];
+		if ("cbor" == encoding)
+		{
+			g_loginEncoding = CBOR_ENCODING;
+		}
+		else if ("msgpack" == encoding)
+		{
+			g_loginEncoding = MSGPACK_ENCODING;
+		}
+		else if ("json" != encoding)
+		{
+			std::cerr << "unknown encoding " << encoding << ", using json" << std::endl;
+		}
+	}
+
 	// create socket on client side
 	int clientfd = socket(AF_INET, SOCK_STREAM, 0);
 
@@ -87,6 +130,10 @@ int main(int argc, char **argv)
 		exit(-1);
 	}
 
+	// keep the connection alive while the user is idle
+	std::thread heartbeatTask(heartbeatTaskHandler, clientfd);
+	heartbeatTask.detach();
+
 	while (true)
 	{
 		// display main menu, login, register, exit
@@ -116,24 +163,22 @@ int main(int argc, char **argv)
 			js["msgid"] = LOGIN_MSG;
 			js["id"] = id;
 			js["password"] = pwd;
-			std::string request = js.dump();
+			js["encoding"] = g_loginEncoding;
 
-			int len = send(clientfd, request.c_str(), strlen(request.c_str()) + 1, 0);
+			int len = sendMsg(clientfd, js);
 			if (len == -1)
 			{
-				std::cerr << "send login msg error:" << request << std::endl;
+				std::cerr << "send login msg error:" << js << std::endl;
 			}
 			else
 			{
-				char buffer[1024] = {0};
-				len = recv(clientfd, buffer, 1024, 0);
-				if (-1 == len)
+				json responsejs;
+				if (!recvMsg(clientfd, responsejs))
 				{
 					std::cerr << "recv login response error" << std::endl;
 				}
 				else
 				{
-					json responsejs = json::parse(buffer);
 					if (0 != responsejs["errno"].get<int>()) // login failed
 					{
 						std::cerr << responsejs["errmsg"] << std::endl;
@@ -195,32 +240,7 @@ int main(int argc, char **argv)
 						// show user data
 						showCurrentUserData();
 
-						// show current user's offline message, if any
-						if (responsejs.contains("offlinemsg"))
-						{
-							std::vector<std::string> vec = responsejs["offlinemsg"];
-							for (std::string &str : vec)
-							{
-								json js = json::parse(str);
-								int msgtype = js["msgid"].get<int>();
-								if (ONE_CHAT_MSG == msgtype)
-								{
-									std::cout << js["time"].get<std::string>() << " [" << js["id"] << "] "
-											  << js["name"].get<std::string>() << " said: "
-											  << js["msg"].get<std::string>() << std::endl;
-									continue;
-								}
-								else if (GROUP_CHAT_MSG == msgtype)
-								{
-									std::cout << "group messsage[" << js["groupid"] << "]:"
-											  << js["time"].get<std::string>() << " [" << js["id"]
-											  << "]" << js["name"].get<std::string>()
-											  << " said: " << js["msg"].get<std::string>() << std::endl;
-									continue;
-								}
-							}
-						}
-
+						// offline messages follow the ack in pages, the read thread shows them
 						static bool isFirstLogin = true;
 						if (isFirstLogin)
 						{
@@ -251,24 +271,21 @@ int main(int argc, char **argv)
 			js["msgid"] = REG_MSG;
 			js["name"] = name;
 			js["password"] = pwd;
-			std::string request = js.dump();
 
-			int len = send(clientfd, request.c_str(), strlen(request.c_str()) + 1, 0);
+			int len = sendMsg(clientfd, js);
 			if (len == -1)
 			{
-				std::cerr << "send reg msg error:" << request << std::endl;
+				std::cerr << "send reg msg error:" << js << std::endl;
 			}
 			else
 			{
-				char buffer[1024] = {0};
-				len = recv(clientfd, buffer, 1024, 0);
-				if (-1 == len)
+				json responsejs;
+				if (!recvMsg(clientfd, responsejs))
 				{
 					std::cerr << "recv reg response error" << std::endl;
 				}
 				else
 				{
-					json responsejs = json::parse(buffer);
 					if (0 != responsejs["errno"].get<int>()) // reg failed
 					{
 						std::cerr << name << " is already exist, register error!" << std::endl;
@@ -324,35 +341,60 @@ void readTaskHandler(int clientfd)
 {
 	while (true)
 	{
-		char buffer[1024] = {0};
-		int len = recv(clientfd, buffer, 1024, 0);
-		if (-1 == len || 0 == len)
+		json js;
+		if (!recvMsg(clientfd, js))
 		{
 			close(clientfd);
 			exit(-1);
 		}
 
-		// receive message from server, deserialize it
-		json js = json::parse(buffer);
 		int msgtype = js["msgid"].get<int>();
-		if (ONE_CHAT_MSG == msgtype)
+		if (ONE_CHAT_MSG == msgtype || GROUP_CHAT_MSG == msgtype)
 		{
-			std::cout << js["time"].get<std::string>() << " [" << js["id"] << "] "
-					  << js["name"].get<std::string>() << " said: "
-					  << js["msg"].get<std::string>() << std::endl;
+			showChatMessage(js);
 			continue;
 		}
-		else if (GROUP_CHAT_MSG == msgtype)
+		else if (OFFLINE_MSG == msgtype)
 		{
-			std::cout << "group messsage[" << js["groupid"] << "]:"
-					  << js["time"].get<std::string>() << " [" << js["id"]
-					  << "]" << js["name"].get<std::string>()
-					  << " said: " << js["msg"].get<std::string>() << std::endl;
+			std::vector<std::string> vec = js["msgs"];
+			for (std::string &str : vec)
+			{
+				showChatMessage(json::parse(str));
+			}
+
+			// the server deletes what was acked and sends the next page
+			json ack;
+			ack["msgid"] = OFFLINE_MSG_ACK;
+			ack["cursor"] = js["cursor"];
+			if (js.contains("groupid"))
+			{
+				// unread group messages move the read cursor of the group
+				ack["groupid"] = js["groupid"];
+			}
+			sendMsg(clientfd, ack);
 			continue;
 		}
 	}
 }
 
+void showChatMessage(const json &js)
+{
+	int msgtype = js["msgid"].get<int>();
+	if (ONE_CHAT_MSG == msgtype)
+	{
+		std::cout << js["time"].get<std::string>() << " [" << js["id"] << "] "
+				  << js["name"].get<std::string>() << " said: "
+				  << js["msg"].get<std::string>() << std::endl;
+	}
+	else if (GROUP_CHAT_MSG == msgtype)
+	{
+		std::cout << "group messsage[" << js["groupid"] << "]:"
+				  << js["time"].get<std::string>() << " [" << js["id"]
+				  << "]" << js["name"].get<std::string>()
+				  << " said: " << js["msg"].get<std::string>() << std::endl;
+	}
+}
+
 // "help" command handler
 void help(int fd = 0, std::string str = "");
 
@@ -440,12 +482,11 @@ void addfriend(int clientfd, std::string str)
 	js["msgid"] = ADD_FRIEND_MSG;
 	js["id"] = g_currentUser.getId();
 	js["friendid"] = friendid;
-	std::string buffer = js.dump();
 
-	int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+	int len = sendMsg(clientfd, js);
 	if (-1 == len)
 	{
-		std::cerr << "send addfriend msg error: " << buffer << std::endl;
+		std::cerr << "send addfriend msg error: " << js << std::endl;
 	}
 }
 
@@ -468,12 +509,11 @@ void chat(int clientfd, std::string str)
 	js["toid"] = friendid;
 	js["msg"] = msg;
 	js["time"] = getCurrentTime();
-	std::string buffer = js.dump();
 
-	int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+	int len = sendMsg(clientfd, js);
 	if (-1 == len)
 	{
-		std::cerr << "send chat msg error: " << buffer << std::endl;
+		std::cerr << "send chat msg error: " << js << std::endl;
 	}
 }
 
@@ -493,12 +533,11 @@ void creategroup(int clientfd, std::string str)
 	js["id"] = g_currentUser.getId();
 	js["groupname"] = groupname;
 	js["groupdesc"] = groupdesc;
-	std::string buffer = js.dump();
 
-	int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+	int len = sendMsg(clientfd, js);
 	if (-1 == len)
 	{
-		std::cerr << "send creategroup msg error: " << buffer << std::endl;
+		std::cerr << "send creategroup msg error: " << js << std::endl;
 	}
 }
 
@@ -509,12 +548,11 @@ void addgroup(int clientfd, std::string str)
 	js["msgid"] = ADD_GROUP_MSG;
 	js["id"] = g_currentUser.getId();
 	js["groupid"] = groupid;
-	std::string buffer = js.dump();
 
-	int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+	int len = sendMsg(clientfd, js);
 	if (-1 == len)
 	{
-		std::cerr << "send addgroup msg error: " << buffer << std::endl;
+		std::cerr << "send addgroup msg error: " << js << std::endl;
 	}
 }
 
@@ -537,12 +575,11 @@ void groupchat(int clientfd, std::string str)
 	js["groupid"] = groupid;
 	js["msg"] = msg;
 	js["time"] = getCurrentTime();
-	std::string buffer = js.dump();
 
-	int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+	int len = sendMsg(clientfd, js);
 	if (-1 == len)
 	{
-		std::cerr << "send groupchat msg error: " << buffer << std::endl;
+		std::cerr << "send groupchat msg error: " << js << std::endl;
 	}
 }
 
@@ -551,12 +588,11 @@ void logout(int clientfd, std::string str)
 	json js;
 	js["msgid"] = LOGOUT_MSG;
 	js["id"] = g_currentUser.getId();
-	std::string buffer = js.dump();
 
-	int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+	int len = sendMsg(clientfd, js);
 	if (-1 == len)
 	{
-		std::cerr << "send logout msg error: " << buffer << std::endl;
+		std::cerr << "send logout msg error: " << js << std::endl;
 	}
 	else
 	{
@@ -573,4 +609,83 @@ std::string getCurrentTime()
 			(int)ptm->tm_year + 1900, (int)ptm->tm_mon + 1, (int)ptm->tm_mday,
 			(int)ptm->tm_hour, (int)ptm->tm_min, (int)ptm->tm_sec);
 	return std::string(date);
-}
\ No newline at end of file
+}
+
+int sendMsg(int clientfd, const json &js)
+{
+	std::lock_guard<std::mutex> lock(g_sendMutex);
+	std::string msg = encodeMessage(js, g_encoding);
+	std::string frame(FRAME_HEADER_LEN, '\0');
+	uint32_t len = htonl(static_cast<uint32_t>(msg.size()));
+	memcpy(&frame[0], &len, FRAME_HEADER_LEN);
+	frame += msg;
+
+	size_t sent = 0;
+	while (sent < frame.size())
+	{
+		int n = send(clientfd, frame.data() + sent, frame.size() - sent, 0);
+		if (-1 == n)
+		{
+			return -1;
+		}
+		sent += n;
+	}
+
+	// the server answers a login request and everything after it with the requested encoding
+	if (js["msgid"].get<int>() == LOGIN_MSG && js.contains("encoding"))
+	{
+		g_encoding = js["encoding"].get<int>();
+	}
+	return sent;
+}
+
+void heartbeatTaskHandler(int clientfd)
+{
+	json js;
+	js["msgid"] = HEARTBEAT_MSG;
+	while (true)
+	{
+		std::this_thread::sleep_for(std::chrono::seconds(HEARTBEAT_INTERVAL));
+		if (-1 == sendMsg(clientfd, js))
+		{
+			return;
+		}
+	}
+}
+
+// read exactly len bytes
+static bool recvAll(int clientfd, char *buf, size_t len)
+{
+	size_t got = 0;
+	while (got < len)
+	{
+		int n = recv(clientfd, buf + got, len - got, 0);
+		if (n <= 0)
+		{
+			return false;
+		}
+		got += n;
+	}
+	return true;
+}
+
+bool recvMsg(int clientfd, json &js)
+{
+	uint32_t len = 0;
+	if (!recvAll(clientfd, reinterpret_cast<char *>(&len), FRAME_HEADER_LEN))
+	{
+		return false;
+	}
+	len = ntohl(len);
+	if (len > static_cast<uint32_t>(MAX_FRAME_LEN))
+	{
+		return false;
+	}
+	std::string msg(len, '\0');
+	if (len != 0 && !recvAll(clientfd, &msg[0], len))
+	{
+		return false;
+	}
+	js = decodeMessage(msg.data(), msg.data() + msg.size(), g_encoding);
+	return !js.is_discarded();
+}
@@ -1,23 +1,39 @@
 #include "chatserver.hpp"
 #include "json.hpp"
 #include "chatservice.hpp"
+#include "session.hpp"
+#include "encoding.hpp"
+#include "public.hpp"
+#include <muduo/base/Logging.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <atomic>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <iostream>
+#include <thread>
 
 using json = nlohmann::json;
 
 ChatServer::ChatServer(EventLoop *loop,
 					   const InetAddress &listenAddr,
-					   const std::string &nameArg)
-	: _server(loop, listenAddr, nameArg),
-	  _loop(loop)
+					   const std::string &nameArg,
+					   const ServerConfig &config,
+					   int threadNum,
+					   TcpServer::Option option)
+	: _server(loop, listenAddr, nameArg, option),
+	  _codec(std::bind(&ChatServer::onMessage, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)),
+	  _loop(loop),
+	  _config(config)
 {
 	_server.setConnectionCallback(std::bind(&ChatServer::onConnection,
 											this, std::placeholders::_1));
-	_server.setMessageCallback(std::bind(&ChatServer::onMessage, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+	_server.setMessageCallback(std::bind(&ChatCodec::onMessage, &_codec, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
 
-	_server.setThreadNum(4);
+	_server.setThreadInitCallback(std::bind(&ChatServer::onThreadInit, this, std::placeholders::_1));
+	_server.setThreadNum(threadNum);
 }
 
 void ChatServer::start()
@@ -25,25 +41,122 @@ void ChatServer::start()
 	_server.start();
 }
 
+// idle detector of the current io thread, nullptr when disabled
+static thread_local TimingWheel *t_timingWheel = nullptr;
+
+void ChatServer::onThreadInit(EventLoop *loop)
+{
+	if (_config.idleTimeout > 0)
+	{
+		std::unique_ptr<TimingWheel> wheel(new TimingWheel(loop, _config.idleTimeout));
+		t_timingWheel = wheel.get();
+		std::lock_guard<std::mutex> lock(_wheelMutex);
+		_wheels.push_back(std::move(wheel));
+	}
+
+	if (_config.cpuAffinity)
+	{
+		pinThread();
+	}
+}
+
+void ChatServer::pinThread()
+{
+	// io threads of every acceptor share one counter, so each gets its own cpu
+	static std::atomic<unsigned> nextCpu{0};
+	unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+	unsigned cpu = nextCpu++ % cpus;
+
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	int err = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+	if (err != 0)
+	{
+		LOG_ERROR << "pin io thread to cpu " << cpu << " failed, errno " << err;
+	}
+	else
+	{
+		LOG_INFO << "io thread pinned to cpu " << cpu;
+	}
+}
+
 void ChatServer::onConnection(const TcpConnectionPtr &conn)
 {
-	if (!conn->connected())
+	if (conn->connected())
+	{
+		SessionPtr session = createSession(conn);
+		if (t_timingWheel != nullptr)
+		{
+			session->idleEntry = t_timingWheel->add(conn);
+		}
+
+		// backpressure for receivers that read slower than we write
+		ChatService *service = ChatService::instance();
+		conn->setHighWaterMarkCallback(std::bind(&ChatService::onHighWaterMark, service,
+												 std::placeholders::_1, std::placeholders::_2),
+									   _config.highWaterMark);
+		conn->setWriteCompleteCallback(std::bind(&ChatService::onWriteComplete, service,
+												 std::placeholders::_1));
+	}
+	else
 	{
-		ChatService::instance()->clientCloseException(conn);
+		// cleanup runs after every message of the connection already queued to its worker
+		ChatService::instance()->runInWorker(conn, [conn]()
+											 { ChatService::instance()->clientCloseException(conn); });
 		conn->shutdown();
 	}
 }
 
 void ChatServer::onMessage(const TcpConnectionPtr &conn,
-						   Buffer *buffer,
+						   json &js,
 						   Timestamp time)
 {
-	std::string buf = buffer->retrieveAllAsString();
-	// deserialize the json string
-	json js = json::parse(buf);
-	std::cout << js << std::endl;
-	auto msgHandler = ChatService::instance()->getHandler(js["msgid"].get<int>());
-
-	// call the callback function
-	msgHandler(conn, js, time);
+	auto msgid = js.find("msgid");
+	if (msgid == js.end() || !msgid->is_number_integer())
+	{
+		LOG_ERROR << "invalid message from " << conn->name();
+		return;
+	}
+
+	// any message, heartbeats included, keeps the connection alive
+	if (t_timingWheel != nullptr)
+	{
+		t_timingWheel->touch(getSession(conn)->idleEntry);
+	}
+	if (msgid->get<int>() == HEARTBEAT_MSG)
+	{
+		return;
+	}
+
+	// full trace at TRACE level, otherwise one message out of every traceSample
+	static thread_local unsigned traceCounter = 0;
+	if (muduo::Logger::logLevel() <= muduo::Logger::TRACE)
+	{
+		LOG_TRACE << conn->name() << " recv " << js.dump();
+	}
+	else if (_config.traceSample > 0 && ++traceCounter % _config.traceSample == 0)
+	{
+		LOG_INFO << conn->name() << " recv (sampled 1/" << _config.traceSample << ") " << js.dump();
+	}
+
+	// a login request selects the payload encoding of the connection,
+	// every later frame in both directions uses it
+	if (msgid->get<int>() == LOGIN_MSG && js.contains("encoding"))
+	{
+		int encoding = js["encoding"].is_number_integer() ? js["encoding"].get<int>() : -1;
+		if (isValidEncoding(encoding))
+		{
+			getSession(conn)->encoding = encoding;
+		}
+		else
+		{
+			LOG_ERROR << "unsupported encoding from " << conn->name();
+		}
+	}
+
+	// call the handler of the message on the business worker of the connection
+	int id = msgid->get<int>();
+	ChatService::instance()->runInWorker(conn, [conn, id, js = std::move(js), time]() mutable
+										 { ChatService::instance()->dispatch(id, conn, js, time); });
 }
@@ -0,0 +1,159 @@
+#include "chatcodec.hpp"
+#include "encoding.hpp"
+#include "session.hpp"
+#include "public.hpp"
+
+#include <muduo/base/Logging.h>
+#include <muduo/net/EventLoop.h>
+
+using muduo::net::EventLoop;
+
+SharedPayload::SharedPayload(const json &js)
+	: _js(&js)
+{
+}
+
+SharedPayload::SharedPayload(std::string text)
+	: _js(nullptr)
+{
+	_encoded[JSON_ENCODING] = std::make_shared<const std::string>(std::move(text));
+}
+
+const PayloadPtr &SharedPayload::encoded(int encoding)
+{
+	static const PayloadPtr invalid;
+	if (!isValidEncoding(encoding))
+	{
+		encoding = JSON_ENCODING;
+	}
+	if (_encoded[encoding])
+	{
+		return _encoded[encoding];
+	}
+
+	if (_js == nullptr)
+	{
+		_parsed = json::parse(*_encoded[JSON_ENCODING], nullptr, false);
+		if (_parsed.is_discarded())
+		{
+			LOG_ERROR << "invalid json payload: " << *_encoded[JSON_ENCODING];
+			return invalid;
+		}
+		_js = &_parsed;
+	}
+	_encoded[encoding] = std::make_shared<const std::string>(encodeMessage(*_js, encoding));
+	return _encoded[encoding];
+}
+
+ChatCodec::ChatCodec(const JsonMessageCallback &cb)
+	: _messageCallback(cb)
+{
+}
+
+// encoding used by the connection
+static int connEncoding(const TcpConnectionPtr &conn)
+{
+	SessionPtr session = getSession(conn);
+	return session ? session->encoding.load() : JSON_ENCODING;
+}
+
+// parse as many complete frames as the buffer holds,
+// the payload is parsed straight out of the buffer without copying it
+void ChatCodec::onMessage(const TcpConnectionPtr &conn,
+						  Buffer *buf,
+						  Timestamp receiveTime)
+{
+	const size_t headerLen = FRAME_HEADER_LEN;
+	while (buf->readableBytes() >= headerLen)
+	{
+		const int32_t len = buf->peekInt32();
+		if (len < 0 || len > MAX_FRAME_LEN)
+		{
+			// the stream cannot be resynced, drop what is buffered and close
+			// both directions so the peer cannot keep filling the buffer
+			LOG_ERROR << "invalid frame length " << len << " from " << conn->name();
+			buf->retrieveAll();
+			conn->forceClose();
+			break;
+		}
+		else if (buf->readableBytes() >= headerLen + len)
+		{
+			// the encoding is read per frame, a LOGIN_MSG may switch it
+			const char *payload = buf->peek() + headerLen;
+			json js = decodeMessage(payload, payload + len, connEncoding(conn));
+			buf->retrieve(headerLen + len);
+			if (js.is_discarded())
+			{
+				LOG_ERROR << "malformed frame from " << conn->name();
+				continue;
+			}
+			_messageCallback(conn, js, receiveTime);
+		}
+		else
+		{
+			// wait for the rest of the frame
+			break;
+		}
+	}
+}
+
+void ChatCodec::send(const TcpConnectionPtr &conn, const json &js)
+{
+	send(conn, encodeMessage(js, connEncoding(conn)));
+}
+
+void ChatCodec::send(const TcpConnectionPtr &conn, std::string payload)
+{
+	EventLoop *loop = conn->getLoop();
+	if (loop->isInLoopThread())
+	{
+		appendInLoop(conn, payload);
+	}
+	else
+	{
+		loop->queueInLoop([conn, payload = std::move(payload)]()
+						  { appendInLoop(conn, payload); });
+	}
+}
+
+void ChatCodec::send(const TcpConnectionPtr &conn, const PayloadPtr &payload)
+{
+	EventLoop *loop = conn->getLoop();
+	if (loop->isInLoopThread())
+	{
+		appendInLoop(conn, *payload);
+	}
+	else
+	{
+		loop->queueInLoop([conn, payload]()
+						  { appendInLoop(conn, *payload); });
+	}
+}
+
+void ChatCodec::appendInLoop(const TcpConnectionPtr &conn, const std::string &payload)
+{
+	SessionPtr session = getSession(conn);
+	if (!session)
+	{
+		Buffer buf;
+		buf.append(payload.data(), payload.size());
+		buf.prependInt32(static_cast<int32_t>(payload.size()));
+		conn->send(&buf);
+		return;
+	}
+
+	session->outbox.appendInt32(static_cast<int32_t>(payload.size()));
+	session->outbox.append(payload.data(), payload.size());
+
+	// the flush is queued behind the functors of this iteration, so every
+	// frame that arrives before it leaves in the same write
+	if (!session->flushPending)
+	{
+		session->flushPending = true;
+		conn->getLoop()->queueInLoop([conn, session]()
+									 {
+										 session->flushPending = false;
+										 conn->send(&session->outbox);
+									 });
+	}
+}
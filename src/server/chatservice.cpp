@@ -1,7 +1,14 @@
 #include "chatservice.hpp"
+#include "chatcodec.hpp"
+#include "session.hpp"
 #include "public.hpp"
+#include "dbexecutor.hpp"
 
+#include <muduo/base/CountDownLatch.h>
 #include <muduo/base/Logging.h>
+#include <array>
+#include <functional>
+#include <unordered_map>
 #include <vector>
 
 // method to get the singleton instance
@@ -11,358 +18,922 @@ ChatService *ChatService::instance()
     return &service;
 }
 
-// server error, reset client data
+// server shutdown, reset client data once the queued writes are stored
 void ChatService::reset()
 {
+    // the close handlers queue db work, whose replies run on the workers
+    // and may queue a last round of it; nothing is left after two rounds
+    for (int round = 0; round < 2; ++round)
+    {
+        drainWorkers();
+        _offlineBatcher.flush();
+        DbExecutor::instance()->drain();
+    }
+    drainWorkers();
+    _workerLoops.clear();
+    _workers.reset();
     _userModel.resetState();
+
+    // other servers must not route to this one any more
+    for (int userid : _userConnMap.keys())
+    {
+        _redis.publishPresence(userid, "");
+        _redis.removeRoute(userid, _node);
+    }
 }
 
-// register message and corresponding callback handler
+// msg id => handler, indexed directly by msgid and built at compile time
+static constexpr std::array<MsgHandler, MSG_TYPE_COUNT> makeHandlerTable()
+{
+    std::array<MsgHandler, MSG_TYPE_COUNT> table{};
+    table[LOGIN_MSG] = &ChatService::login;
+    table[REG_MSG] = &ChatService::reg;
+    table[LOGOUT_MSG] = &ChatService::logout;
+    table[ONE_CHAT_MSG] = &ChatService::oneChat;
+    table[ADD_FRIEND_MSG] = &ChatService::addFriend;
+    table[CREATE_GROUP_MSG] = &ChatService::createGroup;
+    table[ADD_GROUP_MSG] = &ChatService::addGroup;
+    table[GROUP_CHAT_MSG] = &ChatService::groupChat;
+    table[OFFLINE_MSG_ACK] = &ChatService::offlineAck;
+    return table;
+}
+
+static constexpr std::array<MsgHandler, MSG_TYPE_COUNT> msgHandlerTable = makeHandlerTable();
+
 ChatService::ChatService()
+    : _offlineBatcher(_offlineMsgModel, _groupModel)
 {
-    _msgHandlerMap.insert({LOGIN_MSG,
-                           std::bind(&ChatService::login, this, std::placeholders::_1,
-                                     std::placeholders::_2, std::placeholders::_3)});
+    if (_redis.connect())
+    {
+        _redis.init_notify_handler(std::bind(&ChatService::handleRedisSubscribeMessage, this,
+                                             std::placeholders::_1, std::placeholders::_2));
+        _redis.init_presence_handler(std::bind(&ChatService::handlePresenceMessage, this,
+                                               std::placeholders::_1, std::placeholders::_2));
+    }
+}
 
-    _msgHandlerMap.insert({REG_MSG,
-                           std::bind(&ChatService::reg, this, std::placeholders::_1,
-                                     std::placeholders::_2, std::placeholders::_3)});
+// id of the user logged in on the connection, -1 if none
+static int sessionUserId(const TcpConnectionPtr &conn)
+{
+    SessionPtr session = getSession(conn);
+    return session ? session->userid.load() : -1;
+}
 
-    _msgHandlerMap.insert({LOGOUT_MSG,
-                           std::bind(&ChatService::logout, this, std::placeholders::_1,
-                                     std::placeholders::_2, std::placeholders::_3)});
+// call the message handler according to message id
+void ChatService::dispatch(int msgid, const TcpConnectionPtr &conn, json &js, Timestamp time)
+{
+    // record to error log if msgid does not exist
+    if (msgid <= 0 || msgid >= MSG_TYPE_COUNT || msgHandlerTable[msgid] == nullptr)
+    {
+        LOG_ERROR << "msgid: " << msgid << " does not exist!";
+        return;
+    }
 
-    _msgHandlerMap.insert({ONE_CHAT_MSG,
-                           std::bind(&ChatService::oneChat, this, std::placeholders::_1,
-                                     std::placeholders::_2, std::placeholders::_3)});
+    // everything but login and register needs a logged in session,
+    // handlers take the user id from the session, never from the message
+    if (msgid != LOGIN_MSG && msgid != REG_MSG && sessionUserId(conn) == -1)
+    {
+        LOG_ERROR << "msgid: " << msgid << " from " << conn->name() << " before login!";
+        return;
+    }
+    (this->*msgHandlerTable[msgid])(conn, js, time);
+}
 
-    _msgHandlerMap.insert({ADD_FRIEND_MSG,
-                           std::bind(&ChatService::addFriend, this, std::placeholders::_1,
-                                     std::placeholders::_2, std::placeholders::_3)});
+void ChatService::startWorkers(EventLoop *baseLoop, int threadNum)
+{
+    if (threadNum <= 0)
+    {
+        return;
+    }
+    _workers.reset(new EventLoopThreadPool(baseLoop, "ChatWorker"));
+    _workers->setThreadNum(threadNum);
+    _workers->start();
+    // getLoopForHash asserts it runs on the base loop, io threads pick from this copy
+    _workerLoops = _workers->getAllLoops();
+}
 
-    _msgHandlerMap.insert({CREATE_GROUP_MSG,
-                           std::bind(&ChatService::createGroup, this, std::placeholders::_1,
-                                     std::placeholders::_2, std::placeholders::_3)});
+// spread connections over the loops, heap pointers are aligned so their
+// low bits are always zero, a fibonacci hash mixes the high bits down
+static size_t connHash(const TcpConnectionPtr &conn)
+{
+    uint64_t bits = reinterpret_cast<uintptr_t>(conn.get());
+    return static_cast<size_t>((bits * 11400714819323198485ull) >> 32);
+}
 
-    _msgHandlerMap.insert({ADD_GROUP_MSG,
-                           std::bind(&ChatService::addGroup, this, std::placeholders::_1,
-                                     std::placeholders::_2, std::placeholders::_3)});
+// blocking mysql and redis work happens on the worker, replies go back
+// through TcpConnection::send which queues them to the connection's io loop
+void ChatService::drainWorkers()
+{
+    muduo::CountDownLatch latch(static_cast<int>(_workerLoops.size()));
+    for (EventLoop *worker : _workerLoops)
+    {
+        worker->queueInLoop([&latch]()
+                            { latch.countDown(); });
+    }
+    latch.wait();
+}
 
-    _msgHandlerMap.insert({GROUP_CHAT_MSG,
-                           std::bind(&ChatService::groupChat, this, std::placeholders::_1,
-                                     std::placeholders::_2, std::placeholders::_3)});
+void ChatService::runInWorker(const TcpConnectionPtr &conn, std::function<void()> task)
+{
+    if (_workerLoops.empty())
+    {
+        task();
+        return;
+    }
+    EventLoop *worker = _workerLoops[connHash(conn) % _workerLoops.size()];
+    worker->queueInLoop(std::move(task));
+}
 
-    if (_redis.connect())
+void ChatService::setBackpressurePolicy(BackpressurePolicy policy)
+{
+    _backpressure = policy;
+}
+
+// runs in the io loop of the slow receiver
+void ChatService::onHighWaterMark(const TcpConnectionPtr &conn, size_t len)
+{
+    ++_stats.highWaterMark;
+    if (_backpressure == CLOSE_CONNECTION)
     {
-        _redis.init_notify_handler(std::bind(&ChatService::handleRedisSubscribeMessage, this,
-                                             std::placeholders::_1, std::placeholders::_2));
+        ++_stats.closed;
+        LOG_WARN << conn->name() << " output buffer " << len << " bytes, closing slow connection";
+        conn->forceClose();
+        return;
+    }
+
+    LOG_WARN << conn->name() << " output buffer " << len << " bytes, spilling to offline storage";
+    SessionPtr session = getSession(conn);
+    if (session)
+    {
+        session->congested = true;
     }
 }
 
-// obtain message handler according to message id
-MsgHandler ChatService::getHandler(int msgid)
+void ChatService::onWriteComplete(const TcpConnectionPtr &conn)
 {
-    // record to error log if msgid does not exist
-    auto it = _msgHandlerMap.find(msgid);
-    if (it == _msgHandlerMap.end())
+    SessionPtr session = getSession(conn);
+    if (session && session->congested)
     {
-        return [=](const TcpConnectionPtr &conn, json &js, Timestamp time)
+        session->congested = false;
+        LOG_INFO << conn->name() << " output buffer drained";
+        if (session->userid != -1)
         {
-            LOG_ERROR << "msgid: " << msgid << " does not exist!";
-        };
+            runInWorker(conn, [this, conn]()
+                        { sendSpilled(conn); });
+        }
     }
-    else
+}
+
+void ChatService::sendSpilled(const TcpConnectionPtr &conn)
+{
+    SessionPtr session = getSession(conn);
+    int userid = session->userid;
+    if (userid == -1)
     {
-        return _msgHandlerMap[msgid];
+        return;
     }
+    // the acks of a page in flight read from their cursor on another loop
+    // and may miss the spilled rows, look again once the chain runs dry
+    if (session->offlinePaging)
+    {
+        session->spilledBehind = true;
+        return;
+    }
+
+    session->offlinePaging = true;
+    loadOfflinePage(conn, userid);
 }
 
-// handle login message
-void ChatService::login(const TcpConnectionPtr &conn, json &js, Timestamp time)
+void ChatService::loadOfflinePage(const TcpConnectionPtr &conn, int userid)
 {
-    int id = js["id"].get<int>();
-    std::string pwd = js["password"];
+    // the query runs on the writer loop behind the flushed rows
+    SessionPtr session = getSession(conn);
+    _offlineBatcher.flush();
+    DbExecutor::instance()->submit(OfflineBatcher::kWriterKey, [this, userid]()
+                                   { return _offlineMsgModel.query(userid, 0, _offlinePageSize); },
+                                   [this, conn, session](OfflinePage page)
+                                   { continueOfflinePage(conn, *session, page); });
+}
 
-    User user = _userModel.query(id);
+void ChatService::setNode(const std::string &node, int routeTtl)
+{
+    _node = node;
+    _routeTtl = routeTtl;
+    _redis.subscribeNode(node);
+}
 
-    if (user.getId() == id && user.getPassword() == pwd)
+void ChatService::refreshRoutes()
+{
+    std::vector<int> userids = _userConnMap.keys();
+    if (userids.empty())
+    {
+        return;
+    }
+    if (!_redis.refreshRoutes(userids, _node, _routeTtl))
     {
-        if (user.getState() == "online")
+        LOG_ERROR << "refresh of " << userids.size() << " routes failed";
+    }
+
+    // a logout since the snapshot may have removed its route before the
+    // refresh put it back, the registry is left before the route is removed
+    TcpConnectionPtr conn;
+    for (int userid : userids)
+    {
+        if (!_userConnMap.find(userid, conn))
         {
-            // user already online, reject login request
-            json response;
-            response["msgid"] = LOGIN_MSG_ACK;
-            response["errno"] = 2;
-            response["errmsg"] = "user already online";
-            conn->send(response.dump());
+            _redis.removeRoute(userid, _node);
         }
-        else
-        {
-            // record user connection
-            {
-                std::lock_guard<std::mutex> lock(_connMutex);
-                _userConnMap.insert({id, conn});
-            }
+    }
+}
 
-            // subscribe user id to redis
-            _redis.subscribe(id);
+void ChatService::setOfflineBatchRows(int maxRows)
+{
+    _offlineBatcher.setMaxRows(maxRows);
+}
 
-            // login success, state offline => online
-            user.setState("online");
-            _userModel.updateState(user);
+void ChatService::flushOffline()
+{
+    _offlineBatcher.flush();
+}
 
-            json response;
-            response["msgid"] = LOGIN_MSG_ACK;
-            response["errno"] = 0;
-            response["id"] = user.getId();
-            response["name"] = user.getName();
+void ChatService::setOfflinePageSize(int size)
+{
+    _offlinePageSize = size;
+}
 
-            // query offline message
-            std::vector<std::string> vec = _offlineMsgModel.query(id);
+void ChatService::setPresenceTtl(int seconds)
+{
+    _presence.setTtl(seconds);
+}
 
-            if (!vec.empty())
-            {
-                response["offlinemsg"] = vec;
-                // read offline message, delete offline message
-                _offlineMsgModel.remove(id);
-            }
+void ChatService::reportStats()
+{
+    _presence.evictExpired();
 
-            // query friend information
-            std::vector<User> userVec = _friendModel.query(id);
-            if (!userVec.empty())
-            {
-                std::vector<std::string> vec2;
-                for (User &user : userVec)
-                {
-                    json js;
-                    js["id"] = user.getId();
-                    js["name"] = user.getName();
-                    js["state"] = user.getState();
-                    vec2.push_back(js.dump());
-                }
-                response["friends"] = vec2;
-            }
+    uint64_t highWaterMark = _stats.highWaterMark;
+    if (highWaterMark == 0)
+    {
+        return;
+    }
+    LOG_INFO << "backpressure: high water mark " << highWaterMark
+             << ", spilled " << _stats.spilled << ", closed " << _stats.closed;
+}
 
-            // query group information
-            std::vector<Group> groupuserVec = _groupModel.queryGroups(id);
-            if (!groupuserVec.empty())
-            {
-                // group:[{groupid:[xxx, xxx, xxx, xxx]}]
-                std::vector<std::string> groupV;
-                for (Group &group : groupuserVec)
-                {
-                    json grpjson;
-                    grpjson["id"] = group.getId();
-                    grpjson["groupname"] = group.getName();
-                    grpjson["groupdesc"] = group.getDesc();
-                    std::vector<std::string> userV;
-                    for (GroupUser &user : group.getUsers())
-                    {
-                        json js;
-                        js["id"] = user.getId();
-                        js["name"] = user.getName();
-                        js["state"] = user.getState();
-                        js["role"] = user.getRole();
-                        userV.push_back(js.dump());
-                    }
-                    grpjson["users"] = userV;
-                    groupV.push_back(grpjson.dump());
-                }
-
-                response["groups"] = groupV;
-            }
-            conn->send(response.dump());
+void ChatService::deliver(int userid, const TcpConnectionPtr &conn, SharedPayload &payload)
+{
+    SessionPtr session = getSession(conn);
+    if (session && session->congested)
+    {
+        ++_stats.spilled;
+        storeOffline(userid, payload.text());
+        // the buffer drained while the row was added, the drain may have
+        // flushed and queried before it, so look for spilled rows once more
+        if (!session->congested)
+        {
+            runInWorker(conn, [this, conn]()
+                        { sendSpilled(conn); });
         }
+        return;
+    }
+
+    const PayloadPtr &encoded = payload.encoded(session ? session->encoding.load() : JSON_ENCODING);
+    if (encoded)
+    {
+        ChatCodec::send(conn, encoded);
+    }
+}
+
+bool ChatService::findNode(int userid, std::string &node)
+{
+    PresenceCache::State state = _presence.lookup(userid, node);
+    if (state != PresenceCache::UNKNOWN)
+    {
+        return state == PresenceCache::ONLINE;
+    }
+
+    // routes of crashed nodes expire, so a missing route means offline
+    uint64_t version = _presence.readVersion();
+    if (!_redis.getRoute(userid, node))
+    {
+        node.clear();
+        return false;
+    }
+    _presence.setRead(userid, node, version);
+    return !node.empty();
+}
+
+bool ChatService::forwardRemote(const std::vector<int> &userids, const std::string &node, SharedPayload &payload)
+{
+    // PUBLISH counts the subscribers of the node channel, none means the
+    // route was stale and the message would be lost
+    uint64_t version = _presence.readVersion();
+    if (_redis.publishToNode(node, userids, payload.text()) > 0)
+    {
+        return true;
+    }
+    for (int userid : userids)
+    {
+        _presence.setRead(userid, "", version);
+    }
+    return false;
+}
+
+void ChatService::storeOffline(int userid, const std::string &msg)
+{
+    // written behind in multi-row INSERTs, in the order stored
+    _offlineBatcher.add(userid, msg);
+}
+
+void ChatService::setLocalPresence(int userid, bool online)
+{
+    _presence.setLocal(userid, online);
+    if (online)
+    {
+        _redis.setRoute(userid, _node, _routeTtl);
+        _redis.publishPresence(userid, _node);
+        return;
+    }
+
+    // offline is published while the route still blocks a login elsewhere,
+    // so the notification of that login always comes after this one
+    _redis.publishPresence(userid, "");
+    _redis.removeRoute(userid, _node);
+}
+
+// handle login message, the queries run on the db loops and the
+// handler continues in completion callbacks on this thread
+void ChatService::login(const TcpConnectionPtr &conn, json &js, Timestamp time)
+{
+    int id = js["id"].get<int>();
+    std::string pwd = js["password"];
+
+    DbExecutor::instance()->submit(id, [this, id]()
+                                   { return _userModel.query(id); },
+                                   [this, conn, pwd](User user)
+                                   { checkLogin(conn, pwd, user); });
+}
+
+void ChatService::checkLogin(const TcpConnectionPtr &conn, const std::string &pwd, User &user)
+{
+    // a session serves one user, rebinding it would leave the first user
+    // registered here with nobody to clean up after it; checked here and
+    // not in login since a second LOGIN_MSG may arrive before this runs
+    if (sessionUserId(conn) != -1)
+    {
+        json response;
+        response["msgid"] = LOGIN_MSG_ACK;
+        response["errno"] = 3;
+        response["errmsg"] = "connection already logged in";
+        ChatCodec::send(conn, response);
+        return;
     }
-    else
+
+    if (user.getId() == -1 || user.getPassword() != pwd)
     {
         // login failed
         json response;
         response["msgid"] = LOGIN_MSG_ACK;
         response["errno"] = 1;
         response["errmsg"] = "incorrect user id or password!";
-        conn->send(response.dump());
+        ChatCodec::send(conn, response);
+        return;
+    }
+
+    // the client left while the user was loaded, its close handler already ran
+    if (!conn->connected())
+    {
+        return;
+    }
+
+    // the route table knows the live logins, the state column stays
+    // "online" for users of a crashed server; a route to this node without
+    // a registered connection is left over from a failed route removal
+    int id = user.getId();
+    std::string node;
+    TcpConnectionPtr registered;
+    bool online = _redis.getRoute(id, node) ? !node.empty() : user.getState() == "online";
+    if (online && node == _node && !_userConnMap.find(id, registered))
+    {
+        online = false;
+    }
+
+    // record user connection, a concurrent login of the same user here loses the insert
+    bool inserted = false;
+    if (!online)
+    {
+        std::unique_lock<std::shared_mutex> lock(_registerMutex);
+        inserted = _userConnMap.insert(id, conn);
+    }
+    if (!inserted)
+    {
+        // user already online, reject login request
+        json response;
+        response["msgid"] = LOGIN_MSG_ACK;
+        response["errno"] = 2;
+        response["errmsg"] = "user already online";
+        ChatCodec::send(conn, response);
+        return;
     }
+
+    // bind the user to the connection so that disconnect cleanup
+    // does not have to search for it; rows spilled before the ack wait
+    // for the first offline page
+    SessionPtr session = getSession(conn);
+    session->userid = id;
+    session->offlinePaging = true;
+    setLocalPresence(id, true);
+
+    // login success, state offline => online, and load what the ack carries,
+    // one round trip however many groups the user is in
+    DbExecutor::instance()->submit(id, [this, id]()
+                                   {
+                                       LoginSnapshot snapshot;
+                                       if (!_loginModel.load(id, snapshot))
+                                       {
+                                           LOG_ERROR << "login snapshot of " << id << " failed";
+                                       }
+                                       return snapshot;
+                                   },
+                                   [this, conn, user](LoginSnapshot snapshot)
+                                   {
+                                       sendLoginAck(conn, user, snapshot);
+                                       loadOfflinePage(conn, user.getId());
+                                       loadPendingGroups(conn, user.getId());
+                                   });
 }
 
-void ChatService::reg(const TcpConnectionPtr &conn, json &js, Timestamp time)
+void ChatService::loadPendingGroups(const TcpConnectionPtr &conn, int userid)
 {
-    std::string name = js["name"];
-    std::string pwd = js["password"];
+    // runs on the writer loop behind the group log rows of every fan-out
+    // that missed the user while it registered
+    _offlineBatcher.flush();
+    DbExecutor::instance()->submit(OfflineBatcher::kWriterKey, [this, userid]()
+                                   { return _groupModel.queryPending(userid); },
+                                   [this, conn, userid](std::vector<PendingGroup> pending)
+                                   {
+                                       // logged out meanwhile, the cursors were left alone
+                                       SessionPtr session = getSession(conn);
+                                       if (session->userid != userid)
+                                       {
+                                           return;
+                                       }
+                                       for (PendingGroup &group : pending)
+                                       {
+                                           queryGroupPage(conn, userid, group.groupid, group.cursor, group.bound);
+                                       }
+                                       session->groupsLoaded = true;
+                                   });
+}
 
-    User user;
-    user.setName(name);
-    user.setPassword(pwd);
-    bool state = _userModel.insert(user);
-    if (state)
+void ChatService::sendLoginAck(const TcpConnectionPtr &conn, const User &user, LoginSnapshot &snapshot)
+{
+    json response;
+    response["msgid"] = LOGIN_MSG_ACK;
+    response["errno"] = 0;
+    response["id"] = user.getId();
+    response["name"] = user.getName();
+
+    // friend information
+    if (!snapshot.friends.empty())
     {
-        json response;
-        response["msgid"] = REG_MSG_ACK;
-        response["errno"] = 0;
-        response["id"] = user.getId();
-        conn->send(response.dump());
+        std::vector<std::string> vec2;
+        for (User &user : snapshot.friends)
+        {
+            json js;
+            js["id"] = user.getId();
+            js["name"] = user.getName();
+            js["state"] = user.getState();
+            vec2.push_back(js.dump());
+        }
+        response["friends"] = vec2;
     }
-    else
+
+    // group information
+    if (!snapshot.groups.empty())
     {
-        json response;
-        response["msgid"] = REG_MSG_ACK;
-        response["errno"] = 1;
-        conn->send(response.dump());
+        // group:[{groupid:[xxx, xxx, xxx, xxx]}]
+        std::vector<std::string> groupV;
+        for (Group &group : snapshot.groups)
+        {
+            json grpjson;
+            grpjson["id"] = group.getId();
+            grpjson["groupname"] = group.getName();
+            grpjson["groupdesc"] = group.getDesc();
+            std::vector<std::string> userV;
+            for (GroupUser &user : group.getUsers())
+            {
+                json js;
+                js["id"] = user.getId();
+                js["name"] = user.getName();
+                js["state"] = user.getState();
+                js["role"] = user.getRole();
+                userV.push_back(js.dump());
+            }
+            grpjson["users"] = userV;
+            groupV.push_back(grpjson.dump());
+        }
+
+        response["groups"] = groupV;
     }
+    ChatCodec::send(conn, response);
 }
 
-void ChatService::logout(const TcpConnectionPtr &conn, json &js, Timestamp time)
+// at most this many bytes of messages go into one offline page
+static const size_t kMaxOfflinePageBytes = 1024 * 1024;
+
+std::vector<int> ChatService::sendOfflinePage(const TcpConnectionPtr &conn, const OfflinePage &page, int groupid)
 {
-    int userid = js["id"].get<int>();
+    std::vector<int> ids;
+    if (page.empty())
+    {
+        return ids;
+    }
+
+    json response;
+    response["msgid"] = OFFLINE_MSG;
+    if (groupid != -1)
+    {
+        response["groupid"] = groupid;
+    }
+    std::vector<std::string> msgs;
+    size_t bytes = 0;
+    int cursor = 0;
+    for (const auto &msg : page)
     {
-        std::lock_guard<std::mutex> lock(_connMutex);
-        auto it = _userConnMap.find(userid);
-        if (it != _userConnMap.end())
+        // the rest of the page comes again after the ack
+        if (!msgs.empty() && bytes + msg.second.size() > kMaxOfflinePageBytes)
         {
-            _userConnMap.erase(it);
+            break;
         }
+        bytes += msg.second.size();
+        msgs.push_back(msg.second);
+        ids.push_back(msg.first);
+        cursor = msg.first;
     }
+    response["msgs"] = msgs;
+    response["cursor"] = cursor;
+    ChatCodec::send(conn, response);
+    return ids;
+}
 
-    // unsubscribe user id to redis
-    _redis.unsubscribe(userid);
+void ChatService::continueOfflinePage(const TcpConnectionPtr &conn, Session &session, const OfflinePage &page)
+{
+    session.offlinePaging = !page.empty();
+    session.offlineSent = sendOfflinePage(conn, page);
+    if (!session.offlinePaging && session.spilledBehind)
+    {
+        session.spilledBehind = false;
+        sendSpilled(conn);
+    }
+}
 
-    // update user state to offline
-    User user(userid, "", "", "offline");
-    _userModel.updateState(user);
+void ChatService::queryGroupPage(const TcpConnectionPtr &conn, int userid, int groupid, int cursor, int bound)
+{
+    SessionPtr session = getSession(conn);
+    session->pendingGroups[groupid] = bound;
+    DbExecutor::instance()->submit(userid, [this, userid, groupid, cursor, bound]()
+                                   { return _groupModel.queryMessages(userid, groupid, cursor, bound, _offlinePageSize); },
+                                   [conn, session, groupid](OfflinePage page)
+                                   {
+                                       if (page.empty())
+                                       {
+                                           // caught up, from now on logout moves the cursor
+                                           session->pendingGroups.erase(groupid);
+                                           return;
+                                       }
+                                       sendOfflinePage(conn, page, groupid);
+                                   });
 }
 
-void ChatService::clientCloseException(const TcpConnectionPtr &conn)
+// the client got the page in flight, delete exactly its messages and send the next page,
+// for a group page move the read cursor of the member to the acked one instead
+void ChatService::offlineAck(const TcpConnectionPtr &conn, json &js, Timestamp time)
 {
-    User user;
+    int userid = sessionUserId(conn);
+    if (js.contains("groupid"))
     {
-        std::lock_guard<std::mutex> lock(_connMutex);
-        for (auto it = _userConnMap.begin(); it != _userConnMap.end(); ++it)
+        int groupid = js["groupid"].get<int>();
+        int cursor = js["cursor"].get<int>();
+        DbExecutor::instance()->run(userid, [this, userid, groupid, cursor]()
+                                    { _groupModel.ackMessages(userid, groupid, cursor); });
+
+        // the messages after the bound were delivered live, paging ends there
+        SessionPtr session = getSession(conn);
+        auto pending = session->pendingGroups.find(groupid);
+        if (pending == session->pendingGroups.end())
         {
-            if (it->second == conn)
-            {
-                user.setId(it->first);
-                _userConnMap.erase(it);
-                break;
-            }
+            return;
         }
+        if (cursor >= pending->second)
+        {
+            session->pendingGroups.erase(pending);
+            return;
+        }
+        queryGroupPage(conn, userid, groupid, cursor, pending->second);
+        return;
+    }
+
+    // a repeated ack finds no page in flight; a lower id committed after the
+    // page was read is left for the next login instead of being deleted unseen
+    SessionPtr session = getSession(conn);
+    if (session->offlineSent.empty())
+    {
+        return;
     }
+    std::vector<int> ids;
+    ids.swap(session->offlineSent);
+    int cursor = ids.back();
+    DbExecutor::instance()->submit(userid, [this, userid, ids, cursor]()
+                                   {
+                                       _offlineMsgModel.remove(userid, ids);
+                                       return _offlineMsgModel.query(userid, cursor, _offlinePageSize);
+                                   },
+                                   [this, conn, session](OfflinePage page)
+                                   { continueOfflinePage(conn, *session, page); });
+}
 
-    // unsubscribe user id to redis
-    _redis.unsubscribe(user.getId());
+void ChatService::reg(const TcpConnectionPtr &conn, json &js, Timestamp time)
+{
+    std::string name = js["name"];
+    std::string pwd = js["password"];
 
-    if (user.getId() == -1)
+    User user;
+    user.setName(name);
+    user.setPassword(pwd);
+    DbExecutor::instance()->submit(connHash(conn), [this, user]() mutable
+                                   {
+                                       _userModel.insert(user);
+                                       return user.getId();
+                                   },
+                                   [conn](int id)
+                                   {
+                                       json response;
+                                       response["msgid"] = REG_MSG_ACK;
+                                       if (id != -1)
+                                       {
+                                           response["errno"] = 0;
+                                           response["id"] = id;
+                                       }
+                                       else
+                                       {
+                                           response["errno"] = 1;
+                                       }
+                                       ChatCodec::send(conn, response);
+                                   });
+}
+
+void ChatService::markGroupsRead(int userid, Session &session)
+{
+    // the unread groups were never looked up, moving a cursor would drop them
+    if (!session.groupsLoaded)
+    {
+        session.pendingGroups.clear();
+        return;
+    }
+    session.groupsLoaded = false;
+
+    // queued on the writer loop before the registry forgets the user, every
+    // group message the user misses from now on is logged behind it; groups
+    // still being paged keep the cursor of their last ack
+    std::vector<int> skipGroups;
+    for (auto &group : session.pendingGroups)
+    {
+        skipGroups.push_back(group.first);
+    }
+    session.pendingGroups.clear();
+    _offlineBatcher.flush();
+    DbExecutor::instance()->run(OfflineBatcher::kWriterKey, [this, userid, skipGroups]()
+                                { _groupModel.markRead(userid, skipGroups); });
+}
+
+void ChatService::logout(const TcpConnectionPtr &conn, json &js, Timestamp time)
+{
+    SessionPtr session = getSession(conn);
+    int userid = session->userid.exchange(-1);
+    markGroupsRead(userid, *session);
+    _userConnMap.eraseIf(userid, conn);
+    setLocalPresence(userid, false);
+
+    // update user state to offline, ordered after the login update of the same user
+    DbExecutor::instance()->run(userid, [this, userid]()
+                                { _userModel.updateState(User(userid, "", "", "offline")); });
+}
+
+void ChatService::clientCloseException(const TcpConnectionPtr &conn)
+{
+    // the session knows its user, cleanup is O(1)
+    SessionPtr session = getSession(conn);
+    int userid = session ? session->userid.exchange(-1) : -1;
+    if (userid == -1)
     {
         return;
     }
+    markGroupsRead(userid, *session);
+    _userConnMap.eraseIf(userid, conn);
+    setLocalPresence(userid, false);
 
-    user.setState("offline");
-    _userModel.updateState(user);
+    DbExecutor::instance()->run(userid, [this, userid]()
+                                { _userModel.updateState(User(userid, "", "", "offline")); });
 }
 
 void ChatService::oneChat(const TcpConnectionPtr &conn, json &js, Timestamp time)
 {
     int toid = js["toid"].get<int>();
+    js["id"] = sessionUserId(conn);
+    SharedPayload payload(js);
+
+    TcpConnectionPtr toConn;
+    if (_userConnMap.find(toid, toConn))
     {
-        std::lock_guard<std::mutex> lock(_connMutex);
-        auto it = _userConnMap.find(toid);
-        if (it != _userConnMap.end())
-        {
-            // toid online, forward message to toid user
-            it->second->send(js.dump());
-            return;
-        }
+        // toid online, forward message to toid user
+        deliver(toid, toConn, payload);
+        return;
     }
 
-    User user = _userModel.query(toid);
-    if (user.getState() == "online")
+    std::string node;
+    if (findNode(toid, node) && forwardRemote({toid}, node, payload))
     {
-        // toid online, forward message to toid user
-        _redis.publish(toid, js.dump());
+        // toid online on another server, forwarded to its node
         return;
     }
 
-    // not online, store offline message
-    _offlineMsgModel.insert(toid, js.dump());
+    // not online, store offline message; looked up again under the register
+    // lock, so a login here either is seen or reads its offline page after
+    // the row is written
+    {
+        std::shared_lock<std::shared_mutex> lock(_registerMutex);
+        if (!_userConnMap.find(toid, toConn))
+        {
+            storeOffline(toid, payload.text());
+            return;
+        }
+    }
+    deliver(toid, toConn, payload);
 }
 
 void ChatService::addFriend(const TcpConnectionPtr &conn, json &js, Timestamp time)
 {
-    int userid = js["id"].get<int>();
+    int userid = sessionUserId(conn);
     int friendid = js["friendid"].get<int>();
 
     // store friend relationship to database
-    _friendModel.insert(userid, friendid);
+    DbExecutor::instance()->run(userid, [this, userid, friendid]()
+                                { _friendModel.insert(userid, friendid); });
 }
 
 void ChatService::createGroup(const TcpConnectionPtr &conn, json &js, Timestamp time)
 {
-    int userid = js["id"].get<int>();
+    int userid = sessionUserId(conn);
     std::string name = js["groupname"];
     std::string desc = js["groupdesc"];
 
     // store new group info
-    Group group(-1, name, desc);
-    if (_groupModel.createGroup(group))
-    {
-        // add the creater into the group
-        _groupModel.addGroup(userid, group.getId(), "creater");
-    }
+    DbExecutor::instance()->run(userid, [this, userid, name, desc]()
+                                {
+                                    Group group(-1, name, desc);
+                                    if (_groupModel.createGroup(group))
+                                    {
+                                        // add the creater into the group
+                                        _groupModel.addGroup(userid, group.getId(), "creater");
+                                    }
+                                });
 }
 
 void ChatService::addGroup(const TcpConnectionPtr &conn, json &js, Timestamp time)
 {
-    int userid = js["id"].get<int>();
+    int userid = sessionUserId(conn);
     int groupid = js["groupid"].get<int>();
-    _groupModel.addGroup(userid, groupid, "normal");
+    DbExecutor::instance()->run(userid, [this, userid, groupid]()
+                                { _groupModel.addGroup(userid, groupid, "normal"); });
 }
 
 void ChatService::groupChat(const TcpConnectionPtr &conn, json &js, Timestamp time)
 {
-    int userid = js["id"].get<int>();
+    int userid = sessionUserId(conn);
+    js["id"] = userid;
     int groupid = js["groupid"].get<int>();
-    std::vector<int> useridVec = _groupModel.queryGroupUsers(userid, groupid);
 
-    std::lock_guard<std::mutex> lock(_connMutex);
+    // keyed by the group, messages of one group keep their order
+    DbExecutor::instance()->submit(groupid, [this, userid, groupid]()
+                                   { return _groupModel.queryGroupUsers(userid, groupid); },
+                                   [this, js](std::vector<int> useridVec)
+                                   { fanOut(js, useridVec); });
+}
+
+void ChatService::fanOut(const json &js, const std::vector<int> &useridVec)
+{
+    // serialized once per encoding, every member shares the bytes
+    SharedPayload payload(js);
+
+    // snapshot the members connected here, the registry locks are released
+    // before any send, mysql query or redis publish below; the message is
+    // logged once for the group, after the snapshot, so a member seen gone
+    // had its cursor taken before, and under the register lock, so a member
+    // about to log in looks for unread groups after the row is written
+    std::vector<std::pair<int, TcpConnectionPtr>> localMembers;
+    std::vector<int> remoteMembers;
+    int groupid = js["groupid"].get<int>();
+    int userid = js["id"].get<int>();
+    const std::string &text = payload.text();
+    {
+        std::shared_lock<std::shared_mutex> lock(_registerMutex);
+        _userConnMap.findAll(useridVec, localMembers, remoteMembers);
+        _offlineBatcher.addGroupMessage(groupid, userid, text);
+    }
+
+    for (auto &member : localMembers)
+    {
+        // send group message to the user
+        deliver(member.first, member.second, payload);
+    }
 
-    for (int id : useridVec)
+    // members with a fresh cached node skip the route table, offline ones
+    // need nothing more than the log; node => its members
+    std::unordered_map<std::string, std::vector<int>> onlineMembers;
+    std::vector<int> unknownMembers;
+    for (int id : remoteMembers)
     {
-        auto it = _userConnMap.find(id);
-        if (it != _userConnMap.end())
+        std::string node;
+        switch (_presence.lookup(id, node))
         {
-            // send group message to the user
-            it->second->send(js.dump());
+        case PresenceCache::ONLINE:
+            onlineMembers[node].push_back(id);
+            break;
+        case PresenceCache::OFFLINE:
+            break;
+        default:
+            unknownMembers.push_back(id);
+            break;
         }
-        else
+    }
+
+    // one MGET resolves the node of every member missing from the cache
+    uint64_t version = _presence.readVersion();
+    std::vector<std::string> nodes;
+    bool resolved = _redis.getRoutes(unknownMembers, nodes);
+    if (!resolved)
+    {
+        nodes.assign(unknownMembers.size(), std::string());
+    }
+    for (size_t i = 0; i < unknownMembers.size(); ++i)
+    {
+        // a failed read says nothing about the members, keep them uncached
+        if (resolved)
         {
-            User user = _userModel.query(id);
-            if (user.getState() == "online")
-            {
-                // send group message to the user
-                _redis.publish(id, js.dump());
-            }
-            else
-            {
-                // store offline group message
-                _offlineMsgModel.insert(id, js.dump());
-            }
+            _presence.setRead(unknownMembers[i], nodes[i], version);
+        }
+        if (!nodes[i].empty())
+        {
+            onlineMembers[nodes[i]].push_back(unknownMembers[i]);
         }
     }
+
+    for (auto &node : onlineMembers)
+    {
+        // one PUBLISH per node carries the message for all of its members,
+        // an unreachable node left the cursors behind, the log covers them
+        forwardRemote(node.second, node.first, payload);
+    }
 }
 
-void ChatService::handleRedisSubscribeMessage(int userid, std::string msg)
+// msgid of a json text is GROUP_CHAT_MSG, parsed only when a receiver is gone
+static bool isGroupChat(const std::string &text)
 {
-    json js = json::parse(msg.c_str());
+    json js = json::parse(text, nullptr, false);
+    return js.is_object() && js.value("msgid", -1) == GROUP_CHAT_MSG;
+}
 
-    std::lock_guard<std::mutex> lock(_connMutex);
-    auto it = _userConnMap.find(userid);
-    if (it != _userConnMap.end())
+void ChatService::handleRedisSubscribeMessage(std::vector<int> userids, std::string msg)
+{
+    // the json text is forwarded as is, it is only parsed for binary receivers
+    SharedPayload payload(std::move(msg));
+
+    // users gone from here get an offline message, stored under the register
+    // lock like the one of oneChat; a group message is in the group log
+    // already and is read from there at their next login
+    std::vector<std::pair<int, TcpConnectionPtr>> found;
+    std::vector<int> missing;
     {
-        // send message to user
-        it->second->send(js.dump());
+        std::shared_lock<std::shared_mutex> lock(_registerMutex);
+        _userConnMap.findAll(userids, found, missing);
+        if (!missing.empty() && !isGroupChat(payload.text()))
+        {
+            for (int userid : missing)
+            {
+                storeOffline(userid, payload.text());
+            }
+        }
     }
-    else
+
+    for (auto &user : found)
     {
-        // store offline message
-        _offlineMsgModel.insert(userid, msg);
+        // send message to user
+        deliver(user.first, user.second, payload);
     }
+}
+
+void ChatService::handlePresenceMessage(int userid, std::string node)
+{
+    // users logged in here are authoritative, the cache ignores the update for them
+    _presence.setRemote(userid, node);
 }
\ No newline at end of file
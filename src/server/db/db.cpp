@@ -1,5 +1,7 @@
 #include "db.h"
 #include <muduo/base/Logging.h>
+#include <mysql/errmsg.h>
+#include <cstring>
 
 // db config
 const static std::string server = "127.0.0.1";
@@ -7,47 +9,400 @@ const static std::string user = "root";
 const static std::string password = "123456";
 const static std::string dbname = "chat";
 
-MySQL::MySQL()
-	: _conn(mysql_init(nullptr))
+// connections idle for longer than this are pinged before use
+const static std::chrono::seconds kPingAfter(5);
+
+// longest wait for a connection while the pool is exhausted
+const static std::chrono::seconds kAcquireTimeout(5);
+
+// initial buffer of a string column, grown when a value does not fit
+const static size_t kColumnBuffer = 256;
+
+// rows of the largest multi-row INSERT, rows are cut into power of two
+// chunks so every connection prepares only a handful of distinct statements
+const static size_t kMaxInsertRows = 256;
+
+Statement::Statement(Connection *conn, MYSQL_STMT *stmt)
+	: _conn(conn), _stmt(stmt)
 {
 }
 
-MySQL::~MySQL()
+Statement::~Statement()
+{
+	mysql_stmt_close(_stmt);
+}
+
+Statement &Statement::param(int value)
+{
+	_params.push_back({true, value, std::string(), 0});
+	return *this;
+}
+
+Statement &Statement::param(const std::string &value)
+{
+	_params.push_back({false, 0, value, static_cast<unsigned long>(value.size())});
+	return *this;
+}
+
+void Statement::fail(const char *what)
 {
-	if (_conn != nullptr)
+	LOG_INFO << __FILE__ << ":" << __LINE__ << ":" << what << " failed! Error: "
+			 << mysql_stmt_error(_stmt);
+	_conn->checkError(mysql_stmt_errno(_stmt));
+}
+
+bool Statement::execute()
+{
+	// the binds point into _params, build them once every param is in place
+	std::vector<MYSQL_BIND> binds(_params.size());
+	for (size_t i = 0; i < _params.size(); ++i)
+	{
+		Param &param = _params[i];
+		memset(&binds[i], 0, sizeof(MYSQL_BIND));
+		if (param.isInt)
+		{
+			binds[i].buffer_type = MYSQL_TYPE_LONGLONG;
+			binds[i].buffer = &param.intValue;
+		}
+		else
+		{
+			binds[i].buffer_type = MYSQL_TYPE_STRING;
+			binds[i].buffer = const_cast<char *>(param.text.data());
+			binds[i].buffer_length = param.length;
+			binds[i].length = &param.length;
+		}
+	}
+
+	// drop the rows of the previous execution
+	mysql_stmt_free_result(_stmt);
+
+	bool ok = (binds.empty() || mysql_stmt_bind_param(_stmt, binds.data()) == 0) &&
+			  mysql_stmt_execute(_stmt) == 0;
+	_params.clear();
+	if (!ok)
 	{
-		mysql_close(_conn);
+		fail("execute");
+		return false;
+	}
+
+	if (mysql_stmt_field_count(_stmt) == 0)
+	{
+		return true;
 	}
+	// buffer the rows so the connection is free again whatever the caller reads
+	if (mysql_stmt_store_result(_stmt) != 0)
+	{
+		fail("store result");
+		return false;
+	}
+	return _resultBinds.size() == mysql_stmt_field_count(_stmt) || bindResult();
 }
 
-// connect to mysql
-bool MySQL::connect()
+bool Statement::bindResult()
+{
+	MYSQL_RES *meta = mysql_stmt_result_metadata(_stmt);
+	if (meta == nullptr)
+	{
+		fail("result metadata");
+		return false;
+	}
+	unsigned int count = mysql_num_fields(meta);
+	MYSQL_FIELD *fields = mysql_fetch_fields(meta);
+
+	_columns.assign(count, Column());
+	_resultBinds.assign(count, MYSQL_BIND());
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		Column &column = _columns[i];
+		MYSQL_BIND &bind = _resultBinds[i];
+		memset(&bind, 0, sizeof(MYSQL_BIND));
+		switch (fields[i].type)
+		{
+		case MYSQL_TYPE_TINY:
+		case MYSQL_TYPE_SHORT:
+		case MYSQL_TYPE_INT24:
+		case MYSQL_TYPE_LONG:
+		case MYSQL_TYPE_LONGLONG:
+			column.isInt = true;
+			bind.buffer_type = MYSQL_TYPE_LONGLONG;
+			bind.buffer = &column.intValue;
+			break;
+		default:
+			column.isInt = false;
+			column.buffer.resize(kColumnBuffer);
+			bind.buffer_type = MYSQL_TYPE_STRING;
+			bind.buffer = column.buffer.data();
+			bind.buffer_length = column.buffer.size();
+			break;
+		}
+		bind.length = &column.length;
+		bind.is_null = &column.isNull;
+		bind.error = &column.error;
+	}
+	mysql_free_result(meta);
+
+	if (mysql_stmt_bind_result(_stmt, _resultBinds.data()) != 0)
+	{
+		_resultBinds.clear();
+		fail("bind result");
+		return false;
+	}
+	return true;
+}
+
+bool Statement::fetch()
+{
+	if (_resultBinds.empty())
+	{
+		return false;
+	}
+	int ret = mysql_stmt_fetch(_stmt);
+	if (ret == MYSQL_DATA_TRUNCATED)
+	{
+		// grow the buffers of the long values and read them again
+		for (unsigned int i = 0; i < _columns.size(); ++i)
+		{
+			Column &column = _columns[i];
+			if (column.isInt || !column.error)
+			{
+				continue;
+			}
+			column.buffer.resize(column.length);
+			_resultBinds[i].buffer = column.buffer.data();
+			_resultBinds[i].buffer_length = column.buffer.size();
+			if (mysql_stmt_fetch_column(_stmt, &_resultBinds[i], i, 0) != 0)
+			{
+				fail("fetch column");
+				return false;
+			}
+		}
+		mysql_stmt_bind_result(_stmt, _resultBinds.data());
+		return true;
+	}
+	if (ret == 1)
+	{
+		fail("fetch");
+	}
+	return ret == 0;
+}
+
+int Statement::getInt(unsigned int column) const
+{
+	const Column &col = _columns[column];
+	if (col.isNull)
+	{
+		return 0;
+	}
+	return col.isInt ? static_cast<int>(col.intValue) : atoi(std::string(col.buffer.data(), col.length).c_str());
+}
+
+std::string Statement::getString(unsigned int column) const
+{
+	const Column &col = _columns[column];
+	if (col.isNull)
+	{
+		return std::string();
+	}
+	return col.isInt ? std::to_string(col.intValue) : std::string(col.buffer.data(), col.length);
+}
+
+my_ulonglong Statement::insertId()
+{
+	return mysql_stmt_insert_id(_stmt);
+}
+
+Connection::Connection(MYSQL *mysql)
+	: mysql(mysql), broken(false)
+{
+}
+
+Connection::~Connection()
+{
+	// statements must be closed before their connection
+	statements.clear();
+	mysql_close(mysql);
+}
+
+void Connection::checkError(unsigned int err)
+{
+	if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)
+	{
+		broken = true;
+	}
+}
+
+ConnectionPool *ConnectionPool::instance()
+{
+	static ConnectionPool pool;
+	return &pool;
+}
+
+void ConnectionPool::init(size_t minSize, size_t maxSize, int idleTimeout)
 {
-	MYSQL *p = mysql_real_connect(_conn, server.c_str(), user.c_str(),
-								  password.c_str(), dbname.c_str(), 3306, nullptr, 0);
-	if (p != nullptr)
 	{
-		mysql_query(_conn, "set names gbk");
+		std::lock_guard<std::mutex> lock(_mutex);
+		_minSize = minSize;
+		_maxSize = maxSize;
+		_idleTimeout = std::chrono::seconds(idleTimeout);
+	}
+
+	// warm up, the first logins should not pay for the handshake
+	std::vector<std::unique_ptr<Connection>> conns;
+	for (size_t i = 0; i < minSize; ++i)
+	{
+		std::unique_ptr<Connection> conn = acquire();
+		if (!conn)
+		{
+			break;
+		}
+		conns.push_back(std::move(conn));
+	}
+	for (std::unique_ptr<Connection> &conn : conns)
+	{
+		release(std::move(conn));
+	}
+}
+
+std::unique_ptr<Connection> ConnectionPool::open()
+{
+	MYSQL *mysql = mysql_init(nullptr);
+	if (mysql == nullptr)
+	{
+		return nullptr;
+	}
+	// multi statements let a login read everything in one round trip
+	if (mysql_real_connect(mysql, server.c_str(), user.c_str(), password.c_str(),
+						   dbname.c_str(), 3306, nullptr, CLIENT_MULTI_STATEMENTS) == nullptr)
+	{
 		LOG_INFO << __FILE__ << ":" << __LINE__ << ":"
-				 << "connect mysql success!";
+				 << "connect mysql failed! Error: "
+				 << mysql_error(mysql);
+		mysql_close(mysql);
+		return nullptr;
+	}
+	mysql_query(mysql, "set names gbk");
+	LOG_INFO << __FILE__ << ":" << __LINE__ << ":"
+			 << "connect mysql success!";
+	return std::unique_ptr<Connection>(new Connection(mysql));
+}
+
+std::unique_ptr<Connection> ConnectionPool::acquire()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true)
+	{
+		if (!_idle.empty())
+		{
+			IdleConnection idle = std::move(_idle.back());
+			_idle.pop_back();
+			lock.unlock();
+
+			// health check, mysql drops connections idle past wait_timeout
+			if (std::chrono::steady_clock::now() - idle.since < kPingAfter || mysql_ping(idle.conn->mysql) == 0)
+			{
+				return std::move(idle.conn);
+			}
+			LOG_WARN << "pooled mysql connection lost: " << mysql_error(idle.conn->mysql);
+			idle.conn.reset();
+			lock.lock();
+			--_total;
+			continue;
+		}
+
+		if (_total < _maxSize)
+		{
+			// reserve the slot, the handshake runs without the lock
+			++_total;
+			lock.unlock();
+			std::unique_ptr<Connection> conn = open();
+			if (!conn)
+			{
+				lock.lock();
+				--_total;
+				_available.notify_one();
+			}
+			return conn;
+		}
+
+		if (!_available.wait_for(lock, kAcquireTimeout, [this]()
+								 { return !_idle.empty() || _total < _maxSize; }))
+		{
+			LOG_ERROR << "no mysql connection available, " << _total << " in use";
+			return nullptr;
+		}
+	}
+}
+
+void ConnectionPool::release(std::unique_ptr<Connection> conn)
+{
+	if (conn->broken)
+	{
+		conn.reset();
+		std::lock_guard<std::mutex> lock(_mutex);
+		--_total;
 	}
 	else
 	{
-		LOG_INFO << __FILE__ << ":" << __LINE__ << ":"
-        << "connect mysql failed! Error: "
-        << mysql_error(_conn);
+		std::lock_guard<std::mutex> lock(_mutex);
+		_idle.push_back({std::move(conn), std::chrono::steady_clock::now()});
+	}
+	_available.notify_one();
+}
+
+size_t ConnectionPool::evictIdle()
+{
+	std::vector<std::unique_ptr<Connection>> expired;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto deadline = std::chrono::steady_clock::now() - _idleTimeout;
+		// the front holds the connections idle the longest
+		size_t n = 0;
+		while (n < _idle.size() && _total - n > _minSize && _idle[n].since < deadline)
+		{
+			expired.push_back(std::move(_idle[n].conn));
+			++n;
+		}
+		_idle.erase(_idle.begin(), _idle.begin() + n);
+		_total -= n;
+	}
+	// closed here, outside the lock
+	return expired.size();
+}
+
+MySQL::MySQL()
+{
+}
 
+MySQL::~MySQL()
+{
+	if (_conn)
+	{
+		ConnectionPool::instance()->release(std::move(_conn));
 	}
-	return p;
+}
+
+// connect to mysql
+bool MySQL::connect()
+{
+	if (!_conn)
+	{
+		_conn = ConnectionPool::instance()->acquire();
+	}
+	return _conn != nullptr;
 }
 
 // update method
 bool MySQL::update(std::string sql)
 {
-	if (mysql_query(_conn, sql.c_str()))
+	if (!_conn)
+	{
+		return false;
+	}
+	if (mysql_query(_conn->mysql, sql.c_str()))
 	{
 		LOG_INFO << __FILE__ << ":" << __LINE__ << ":" << sql << "update failed! Error: "
-				 << mysql_error(_conn);
+				 << mysql_error(_conn->mysql);
+		_conn->checkError(mysql_errno(_conn->mysql));
 		return false;
 	}
 	return true;
@@ -56,16 +411,145 @@ bool MySQL::update(std::string sql)
 // query method, return some result
 MYSQL_RES *MySQL::query(std::string sql)
 {
-	if (mysql_query(_conn, sql.c_str()))
+	if (!_conn)
+	{
+		return nullptr;
+	}
+	if (mysql_query(_conn->mysql, sql.c_str()))
 	{
 		LOG_INFO << __FILE__ << ":" << __LINE__ << ":" << sql << "query failed!";
+		_conn->checkError(mysql_errno(_conn->mysql));
 		return nullptr;
 	}
-	return mysql_use_result(_conn);
+	// buffer the whole result, the connection is reusable even if the
+	// caller stops reading early
+	return mysql_store_result(_conn->mysql);
+}
+
+bool MySQL::queryMulti(const std::string &sql, std::vector<MYSQL_RES *> &results)
+{
+	if (!_conn)
+	{
+		return false;
+	}
+	MYSQL *mysql = _conn->mysql;
+	if (mysql_real_query(mysql, sql.data(), sql.size()))
+	{
+		LOG_INFO << __FILE__ << ":" << __LINE__ << ":" << sql << "query failed! Error: "
+				 << mysql_error(mysql);
+		_conn->checkError(mysql_errno(mysql));
+		return false;
+	}
+
+	// every result has to be read, or the connection is out of sync
+	size_t first = results.size();
+	bool ok = true;
+	while (true)
+	{
+		MYSQL_RES *res = mysql_store_result(mysql);
+		if (res != nullptr)
+		{
+			results.push_back(res);
+		}
+		else if (mysql_field_count(mysql) != 0)
+		{
+			ok = false;
+		}
+
+		int status = mysql_next_result(mysql);
+		if (status == -1)
+		{
+			break;
+		}
+		if (status > 0)
+		{
+			// a statement failed, the ones after it did not run
+			LOG_INFO << __FILE__ << ":" << __LINE__ << ":" << sql << "query failed! Error: "
+					 << mysql_error(mysql);
+			_conn->checkError(mysql_errno(mysql));
+			ok = false;
+			break;
+		}
+	}
+
+	if (!ok)
+	{
+		for (size_t i = first; i < results.size(); ++i)
+		{
+			mysql_free_result(results[i]);
+		}
+		results.resize(first);
+	}
+	return ok;
+}
+
+Statement *MySQL::prepare(const std::string &sql)
+{
+	if (!_conn)
+	{
+		return nullptr;
+	}
+	std::unique_ptr<Statement> &cached = _conn->statements[sql];
+	if (cached)
+	{
+		return cached.get();
+	}
+
+	MYSQL_STMT *stmt = mysql_stmt_init(_conn->mysql);
+	if (stmt == nullptr)
+	{
+		_conn->statements.erase(sql);
+		return nullptr;
+	}
+	if (mysql_stmt_prepare(stmt, sql.data(), sql.size()) != 0)
+	{
+		LOG_INFO << __FILE__ << ":" << __LINE__ << ":" << sql << "prepare failed! Error: "
+				 << mysql_stmt_error(stmt);
+		_conn->checkError(mysql_stmt_errno(stmt));
+		mysql_stmt_close(stmt);
+		_conn->statements.erase(sql);
+		return nullptr;
+	}
+	cached.reset(new Statement(_conn.get(), stmt));
+	return cached.get();
+}
+
+bool MySQL::insertRows(const std::string &sql, size_t count,
+					   const std::function<void(Statement &, size_t)> &bind)
+{
+	std::string tuple = sql.substr(sql.rfind('('));
+	bool ok = true;
+	size_t i = 0;
+	while (i < count)
+	{
+		size_t rows = kMaxInsertRows;
+		while (rows > count - i)
+		{
+			rows /= 2;
+		}
+
+		std::string chunkSql = sql;
+		for (size_t j = 1; j < rows; ++j)
+		{
+			chunkSql += ", " + tuple;
+		}
+		Statement *stmt = prepare(chunkSql);
+		if (stmt == nullptr)
+		{
+			return false;
+		}
+		for (size_t j = i; j < i + rows; ++j)
+		{
+			bind(*stmt, j);
+		}
+		ok = stmt->execute() && ok;
+		i += rows;
+	}
+	return ok;
 }
 
 // get connection
 MYSQL *MySQL::getConnection()
 {
-	return _conn;
-}
\ No newline at end of file
+	return _conn ? _conn->mysql : nullptr;
+}
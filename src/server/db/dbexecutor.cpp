@@ -0,0 +1,46 @@
+#include "dbexecutor.hpp"
+
+#include <muduo/base/CountDownLatch.h>
+
+DbExecutor *DbExecutor::instance()
+{
+	static DbExecutor executor;
+	return &executor;
+}
+
+void DbExecutor::start(EventLoop *baseLoop, int threadNum)
+{
+	if (threadNum <= 0)
+	{
+		return;
+	}
+	_loops.reset(new EventLoopThreadPool(baseLoop, "ChatDb"));
+	_loops->setThreadNum(threadNum);
+	_loops->start();
+	_loopList = _loops->getAllLoops();
+}
+
+void DbExecutor::run(size_t key, std::function<void()> task)
+{
+	if (_loopList.empty())
+	{
+		task();
+		return;
+	}
+	_loopList[key % _loopList.size()]->queueInLoop(std::move(task));
+}
+
+void DbExecutor::drain()
+{
+	if (_loopList.empty())
+	{
+		return;
+	}
+	muduo::CountDownLatch latch(static_cast<int>(_loopList.size()));
+	for (EventLoop *loop : _loopList)
+	{
+		loop->queueInLoop([&latch]()
+						  { latch.countDown(); });
+	}
+	latch.wait();
+}
@@ -1,33 +1,153 @@
 #include "chatserver.hpp"
 #include "chatservice.hpp"
+#include "serverconfig.hpp"
+#include "db.h"
+#include "dbexecutor.hpp"
+#include <muduo/net/Channel.h>
+#include <muduo/net/EventLoopThread.h>
+#include <muduo/base/AsyncLogging.h>
+#include <muduo/base/CountDownLatch.h>
+#include <muduo/base/Logging.h>
+#include <algorithm>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 #include <signal.h>
-void resetHandler(int)
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+using muduo::net::EventLoopThread;
+
+// asynchronous log backend, nullptr when logging to stdout
+std::unique_ptr<muduo::AsyncLogging> g_asyncLog;
+
+void asyncOutput(const char *msg, int len)
 {
-	ChatService::instance()->reset();
-	std::cout << "ChatService reset!" << std::endl;
-	exit(0);
+	g_asyncLog->append(msg, len);
 }
 
 int main(int argc, char **argv)
 {
-	if (argc < 3)
+	ServerConfig config;
+	if (!parseServerConfig(argc, argv, config))
 	{
-		std::cerr << "command invalid! example: ./ChatServer 127.0.0.1 6000" << std::endl;
 		exit(-1);
 	}
 
-	char *ip = argv[1];
-	uint16_t port = atoi(argv[2]);
+	// SIGINT and SIGTERM are read from a signalfd by the main loop, blocked
+	// before any thread starts so that every thread inherits the mask
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
 
-	signal(SIGINT, resetHandler);
+	muduo::Logger::setLogLevel(config.logLevel);
+	if (!config.logFile.empty())
+	{
+		// double buffered log file written by a background thread
+		g_asyncLog.reset(new muduo::AsyncLogging(config.logFile, config.logRollSize));
+		g_asyncLog->start();
+		muduo::Logger::setOutput(asyncOutput);
+	}
 
 	EventLoop loop;
-	InetAddress addr(ip, port);
-	ChatServer server(&loop, addr, "ChatServer");
+	InetAddress addr(config.ip, config.port);
+
+	int signalFd = ::signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	muduo::net::Channel signalChannel(&loop, signalFd);
+	signalChannel.setReadCallback([&loop, signalFd](muduo::Timestamp)
+								  {
+									  signalfd_siginfo info;
+									  if (::read(signalFd, &info, sizeof info) == sizeof info)
+									  {
+										  loop.quit();
+									  }
+								  });
+	signalChannel.enableReading();
+
+	ConnectionPool::instance()->init(config.dbPoolMin, config.dbPoolMax, config.dbIdleTimeout);
+	loop.runEvery(60.0, []()
+				  { ConnectionPool::instance()->evictIdle(); });
+
+	// every db loop holds at most one pooled connection at a time
+	DbExecutor::instance()->start(&loop, config.dbThreads);
+
+	// handlers block on mysql, keep them off the io threads
+	ChatService::instance()->startWorkers(&loop, config.workerThreads);
+	ChatService::instance()->setBackpressurePolicy(config.backpressure);
+	ChatService::instance()->setNode(config.nodeId, config.routeTtl);
+	ChatService::instance()->setPresenceTtl(config.presenceTtl);
+	ChatService::instance()->setOfflinePageSize(config.offlinePageSize);
+	ChatService::instance()->setOfflineBatchRows(config.offlineBatch);
+	loop.runEvery(config.offlineFlushMs / 1000.0, []()
+				  { ChatService::instance()->flushOffline(); });
+	// refresh well before expiry so a slow round trip does not drop a route
+	loop.runEvery(std::max(config.routeTtl / 3, 1), []()
+				  { ChatService::instance()->refreshRoutes(); });
+	loop.runEvery(60.0, []()
+				  { ChatService::instance()->reportStats(); });
+
+	// with several acceptors every one listens on the same port with SO_REUSEPORT
+	// in its own loop thread and owns a share of the io threads
+	TcpServer::Option option = config.acceptors > 1 ? TcpServer::kReusePort : TcpServer::kNoReusePort;
+	std::vector<std::unique_ptr<EventLoopThread>> acceptorThreads;
+	std::vector<std::unique_ptr<ChatServer>> servers;
+	std::vector<EventLoop *> acceptLoops;
+	for (int i = 0; i < config.acceptors; ++i)
+	{
+		EventLoop *acceptLoop = &loop;
+		if (i > 0)
+		{
+			acceptorThreads.emplace_back(new EventLoopThread(EventLoopThread::ThreadInitCallback(),
+															 "ChatAcceptor" + std::to_string(i)));
+			acceptLoop = acceptorThreads.back()->startLoop();
+		}
+
+		int threadNum = config.ioThreads / config.acceptors + (i < config.ioThreads % config.acceptors ? 1 : 0);
+		std::string name = config.acceptors > 1 ? "ChatServer" + std::to_string(i) : "ChatServer";
+		servers.emplace_back(new ChatServer(acceptLoop, addr, name, config, threadNum, option));
+		acceptLoops.push_back(acceptLoop);
+
+		// TcpServer::start must run in the thread of its accept loop
+		ChatServer *server = servers.back().get();
+		acceptLoop->runInLoop([server]()
+							  { server->start(); });
+	}
 
-	server.start();
 	loop.loop();
 
-	return 0;
-}
\ No newline at end of file
+	// stopped by a signal, no new connection or message comes in from here:
+	// a TcpServer torn down in its accept loop closes its connections and
+	// joins its io threads, the close handlers are queued to the workers;
+	// runInLoop tears the server of the main loop down right here
+	signalChannel.disableAll();
+	signalChannel.remove();
+	::close(signalFd);
+	for (size_t i = 0; i < servers.size(); ++i)
+	{
+		muduo::CountDownLatch closed(1);
+		ChatServer *server = servers[i].release();
+		acceptLoops[i]->runInLoop([server, &closed]()
+								  {
+									  delete server;
+									  closed.countDown();
+								  });
+		closed.wait();
+	}
+	acceptorThreads.clear();
+
+	// the workers and db loops finish the queued work and store the writes
+	ChatService::instance()->reset();
+	std::cout << "ChatService reset!" << std::endl;
+	if (g_asyncLog)
+	{
+		// flush the buffered log lines before leaving
+		g_asyncLog->stop();
+	}
+
+	// the redis listener still blocks on its socket in a detached thread,
+	// static destructors would free the context under it
+	_exit(0);
+}
@@ -4,43 +4,37 @@
 // add friend
 void FriendModel::insert(int userid, int friendid)
 {
-	char sql[1024] = {0};
-	sprintf(sql, "INSERT INTO Friend VALUES(%d, %d)", userid, friendid);
-
 	MySQL mysql;
 	if (mysql.connect())
 	{
-		mysql.update(sql);
+		Statement *stmt = mysql.prepare("INSERT INTO Friend VALUES(?, ?)");
+		if (stmt != nullptr)
+		{
+			stmt->param(userid).param(friendid).execute();
+		}
 	}
 }
 
 std::vector<User> FriendModel::query(int userid)
 {
-	char sql[1024] = {0};
-	sprintf(sql, "SELECT a.id,a.name,a.state \
-			FROM Users a INNER JOIN Friend b ON b.friendid = a.id \
-			WHERE b.userid = %d",
-			userid);
-	
 	std::vector<User> vec;
 	MySQL mysql;
 	if (mysql.connect())
 	{
-		MYSQL_RES *res = mysql.query(sql);
-		if (res != nullptr)
+		Statement *stmt = mysql.prepare("SELECT a.id, a.name, a.state "
+										"FROM Users a INNER JOIN Friend b ON b.friendid = a.id "
+										"WHERE b.userid = ?");
+		if (stmt != nullptr && stmt->param(userid).execute())
 		{
-			MYSQL_ROW row;
-			while ((row = mysql_fetch_row(res)) != nullptr)
+			while (stmt->fetch())
 			{
 				User user;
-				user.setId(atoi(row[0]));
-				user.setName(row[1]);
-				user.setState(row[2]);
+				user.setId(stmt->getInt(0));
+				user.setName(stmt->getString(1));
+				user.setState(stmt->getString(2));
 				vec.push_back(user);
 			}
-			mysql_free_result(res);
-			
 		}
 	}
 	return vec;
-}
\ No newline at end of file
+}
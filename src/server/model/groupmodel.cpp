@@ -4,16 +4,13 @@
 // create a group
 bool GroupModel::createGroup(Group &group)
 {
-	char sql[1024];
-	sprintf(sql, "INSERT INTO AllGroup(groupname, groupdesc) VALUES('%s', '%s')",
-			group.getName().c_str(), group.getDesc().c_str());
-
 	MySQL mysql;
 	if (mysql.connect())
 	{
-		if (mysql.update(sql))
+		Statement *stmt = mysql.prepare("INSERT INTO AllGroup(groupname, groupdesc) VALUES(?, ?)");
+		if (stmt != nullptr && stmt->param(group.getName()).param(group.getDesc()).execute())
 		{
-			group.setId(mysql_insert_id(mysql.getConnection()));
+			group.setId(stmt->insertId());
 			return true;
 		}
 	}
@@ -24,88 +21,127 @@ bool GroupModel::createGroup(Group &group)
 // join a group
 void GroupModel::addGroup(int userid, int groupid, std::string role)
 {
-	char sql[1024];
-	sprintf(sql, "INSERT INTO GroupUser(groupid, userid, grouprole) VALUES(%d, %d, '%s')",
-			groupid, userid, role.c_str());
-
 	MySQL mysql;
 	if (mysql.connect())
 	{
-		mysql.update(sql);
+		// start the cursor at the newest message, the history is not pending for a new member
+		Statement *stmt = mysql.prepare("INSERT INTO GroupUser(groupid, userid, grouprole, lastread) "
+										"SELECT ?, ?, ?, COALESCE(MAX(id), 0) FROM GroupMessage WHERE groupid = ?");
+		if (stmt != nullptr)
+		{
+			stmt->param(groupid).param(userid).param(role).param(groupid).execute();
+		}
 	}
 }
 
-// query user's group information
-std::vector<Group> GroupModel::queryGroups(int userid)
+std::vector<int> GroupModel::queryGroupUsers(int userid, int groupid)
 {
-	char sql[1024];
-	sprintf(sql, "SELECT a.id, a.groupname, a.groupdesc FROM AllGroup a INNER JOIN  \
-				GroupUser b on a.id = b.groupid WHERE b.userid = %d",
-			userid);
+	std::vector<int> idVec;
+	MySQL mysql;
+	if (mysql.connect())
+	{
+		Statement *stmt = mysql.prepare("SELECT userid FROM GroupUser WHERE groupid = ? AND userid <> ?");
+		if (stmt != nullptr && stmt->param(groupid).param(userid).execute())
+		{
+			while (stmt->fetch())
+			{
+				idVec.push_back(stmt->getInt(0));
+			}
+		}
+	}
+	return idVec;
+}
 
-	std::vector<Group> groupVec;
+void GroupModel::insertMessages(const GroupLogBatch &batch)
+{
+	MySQL mysql;
+	if (mysql.connect())
+	{
+		mysql.insertRows("INSERT INTO GroupMessage(groupid, userid, message) VALUES(?, ?, ?)", batch.size(),
+						 [&batch](Statement &stmt, size_t i)
+						 { stmt.param(batch[i].groupid).param(batch[i].userid).param(batch[i].msg); });
+	}
+}
 
+std::vector<PendingGroup> GroupModel::queryPending(int userid)
+{
+	std::vector<PendingGroup> pending;
 	MySQL mysql;
 	if (mysql.connect())
 	{
-		MYSQL_RES *res = mysql.query(sql);
-		if (res != nullptr)
+		Statement *stmt = mysql.prepare("SELECT b.groupid, b.lastread, MAX(g.id) FROM GroupUser b "
+										"INNER JOIN GroupMessage g ON g.groupid = b.groupid "
+										"AND g.id > b.lastread AND g.userid <> ? "
+										"WHERE b.userid = ? GROUP BY b.groupid, b.lastread");
+		if (stmt != nullptr && stmt->param(userid).param(userid).execute())
 		{
-			MYSQL_ROW row;
-
-			while ((row = mysql_fetch_row(res)) != nullptr)
+			while (stmt->fetch())
 			{
-				Group group;
-				group.setId(atoi(row[0])).setName(row[1]).setDesc(row[2]);
-				groupVec.push_back(group);
+				pending.push_back({stmt->getInt(0), stmt->getInt(1), stmt->getInt(2)});
 			}
-			mysql_free_result(res);
 		}
 	}
+	return pending;
+}
 
-	for (Group &group : groupVec)
+OfflinePage GroupModel::queryMessages(int userid, int groupid, int cursor, int bound, int limit)
+{
+	OfflinePage page;
+	MySQL mysql;
+	if (mysql.connect())
 	{
-		sprintf(sql, "SELECT a.id, a.name, a.state, b.grouprole FROM Users a INNER JOIN \
-					GroupUser b on b.userid = a.id WHERE b.groupid = %d",
-				group.getId());
-		
-		MYSQL_RES *res = mysql.query(sql);
-		if (res != nullptr)
+		Statement *stmt = mysql.prepare("SELECT g.id, g.message FROM GroupMessage g "
+										"INNER JOIN GroupUser b ON b.groupid = g.groupid AND b.userid = ? "
+										"WHERE g.groupid = ? AND g.id > ? AND g.id <= ? AND g.userid <> ? ORDER BY g.id LIMIT ?");
+		if (stmt != nullptr &&
+			stmt->param(userid).param(groupid).param(cursor).param(bound).param(userid).param(limit).execute())
 		{
-			MYSQL_ROW row;
-			while ((row = mysql_fetch_row(res)) != nullptr)
+			while (stmt->fetch())
 			{
-				GroupUser user;
-				user.setId(atoi(row[0])).setName(row[1]).setState(row[2]);
-				user.setRole(row[3]);
-				group.getUsers().push_back(user);
+				page.emplace_back(stmt->getInt(0), stmt->getString(1));
 			}
-			mysql_free_result(res);
 		}
 	}
-	return groupVec;
+	return page;
 }
 
-
-std::vector<int> GroupModel::queryGroupUsers(int userid, int groupid)
+void GroupModel::ackMessages(int userid, int groupid, int cursor)
 {
-	char sql[1024] = {0};
-	sprintf(sql, "SELECT userid FROM GroupUser where groupid = %d AND userid <> %d", groupid, userid);
-
-	std::vector<int> idVec;
 	MySQL mysql;
 	if (mysql.connect())
 	{
-		MYSQL_RES *res = mysql.query(sql);
-		if (res != nullptr)
+		Statement *stmt = mysql.prepare("UPDATE GroupUser SET lastread = ? "
+										"WHERE userid = ? AND groupid = ? AND lastread < ?");
+		if (stmt != nullptr)
+		{
+			stmt->param(cursor).param(userid).param(groupid).param(cursor).execute();
+		}
+	}
+}
+
+void GroupModel::markRead(int userid, const std::vector<int> &skipGroups)
+{
+	// integers only, the skip list makes the statement text vary
+	std::string sql = "UPDATE GroupUser b SET lastread = (SELECT COALESCE(MAX(g.id), b.lastread) "
+					  "FROM GroupMessage g WHERE g.groupid = b.groupid) WHERE b.userid = " +
+					  std::to_string(userid);
+	if (!skipGroups.empty())
+	{
+		sql += " AND b.groupid NOT IN (";
+		for (size_t i = 0; i < skipGroups.size(); ++i)
 		{
-			MYSQL_ROW row;
-			while ((row = mysql_fetch_row(res)) != nullptr)
+			if (i > 0)
 			{
-				idVec.push_back(atoi(row[0]));
+				sql += ',';
 			}
-			mysql_free_result(res);
+			sql += std::to_string(skipGroups[i]);
 		}
+		sql += ')';
 	}
-	return idVec;
-}
\ No newline at end of file
+
+	MySQL mysql;
+	if (mysql.connect())
+	{
+		mysql.update(sql);
+	}
+}
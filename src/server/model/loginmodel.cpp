@@ -0,0 +1,81 @@
+#include "loginmodel.hpp"
+#include "db.h"
+#include <unordered_map>
+
+// kind of a row of the snapshot query
+enum SnapshotRow
+{
+	FRIEND_ROW = 1,
+	GROUP_ROW,
+	MEMBER_ROW,
+};
+
+// both statements are sent together; the SELECT returns every part of the
+// snapshot as rows of (kind, id, userid, text1, text2, text3)
+static std::string loginSql(int userid)
+{
+	std::string id = std::to_string(userid);
+	return "UPDATE Users SET state = 'online' WHERE id = " + id + ";"
+		   "SELECT " + std::to_string(FRIEND_ROW) + ", a.id, 0, a.name, a.state, NULL "
+		   "FROM Users a INNER JOIN Friend b ON b.friendid = a.id WHERE b.userid = " + id +
+		   " UNION ALL SELECT " + std::to_string(GROUP_ROW) + ", a.id, 0, a.groupname, a.groupdesc, NULL "
+		   "FROM AllGroup a INNER JOIN GroupUser b ON a.id = b.groupid WHERE b.userid = " + id +
+		   " UNION ALL SELECT " + std::to_string(MEMBER_ROW) + ", m.groupid, u.id, u.name, u.state, m.grouprole "
+		   "FROM GroupUser b INNER JOIN GroupUser m ON m.groupid = b.groupid "
+		   "INNER JOIN Users u ON u.id = m.userid WHERE b.userid = " + id;
+}
+
+bool LoginModel::load(int userid, LoginSnapshot &snapshot)
+{
+	MySQL mysql;
+	std::vector<MYSQL_RES *> results;
+	if (!mysql.connect() || !mysql.queryMulti(loginSql(userid), results) || results.size() != 1)
+	{
+		for (MYSQL_RES *res : results)
+		{
+			mysql_free_result(res);
+		}
+		return false;
+	}
+
+	// rows of one kind may arrive in any order, members are attached at the end
+	std::unordered_map<int, std::vector<GroupUser>> members;
+	MYSQL_ROW row;
+	while ((row = mysql_fetch_row(results[0])) != nullptr)
+	{
+		switch (atoi(row[0]))
+		{
+		case FRIEND_ROW:
+		{
+			User user;
+			user.setId(atoi(row[1]));
+			user.setName(row[3]);
+			user.setState(row[4]);
+			snapshot.friends.push_back(user);
+			break;
+		}
+		case GROUP_ROW:
+		{
+			Group group;
+			group.setId(atoi(row[1])).setName(row[3]).setDesc(row[4] != nullptr ? row[4] : "");
+			snapshot.groups.push_back(group);
+			break;
+		}
+		case MEMBER_ROW:
+		{
+			GroupUser user;
+			user.setId(atoi(row[2])).setName(row[3]).setState(row[4]);
+			user.setRole(row[5]);
+			members[atoi(row[1])].push_back(user);
+			break;
+		}
+		}
+	}
+	mysql_free_result(results[0]);
+
+	for (Group &group : snapshot.groups)
+	{
+		group.getUsers() = std::move(members[group.getId()]);
+	}
+	return true;
+}
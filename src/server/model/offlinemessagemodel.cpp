@@ -1,23 +1,35 @@
 #include "offlinemessagemodel.hpp"
 #include "db.h"
 
-// store offline message
-void OfflineMsgModel::insert(int userid, std::string msg)
+void OfflineMsgModel::insert(const OfflineBatch &batch)
 {
-	char sql[1024] = {0};
-	sprintf(sql, "INSERT INTO OfflineMessage VALUES(%d, '%s')", userid, msg.c_str());
-
 	MySQL mysql;
 	if (mysql.connect())
 	{
-		mysql.update(sql);
+		mysql.insertRows("INSERT INTO OfflineMessage(userid, message) VALUES(?, ?)", batch.size(),
+						 [&batch](Statement &stmt, size_t i)
+						 { stmt.param(batch[i].first).param(batch[i].second); });
 	}
 }
 
-void OfflineMsgModel::remove(int userid)
+void OfflineMsgModel::remove(int userid, const std::vector<int> &ids)
 {
-	char sql[1024] = {0};
-	sprintf(sql, "DELETE FROM OfflineMessage WHERE userid=%d", userid);
+	if (ids.empty())
+	{
+		return;
+	}
+
+	// integers only, the id count makes the statement text vary
+	std::string sql = "DELETE FROM OfflineMessage WHERE userid = " + std::to_string(userid) + " AND id IN (";
+	for (size_t i = 0; i < ids.size(); ++i)
+	{
+		if (i > 0)
+		{
+			sql += ',';
+		}
+		sql += std::to_string(ids[i]);
+	}
+	sql += ')';
 
 	MySQL mysql;
 	if (mysql.connect())
@@ -26,26 +38,21 @@ void OfflineMsgModel::remove(int userid)
 	}
 }
 
-std::vector<std::string> OfflineMsgModel::query(int userid)
+OfflinePage OfflineMsgModel::query(int userid, int cursor, int limit)
 {
-	char sql[1024] = {0};
-	sprintf(sql, "SELECT message FROM OfflineMessage WHERE userid=%d", userid);
-
-	std::vector<std::string> vec;
+	OfflinePage page;
 	MySQL mysql;
 	if (mysql.connect())
 	{
-		MYSQL_RES *res = mysql.query(sql);
-		if (res != nullptr)
+		Statement *stmt = mysql.prepare("SELECT id, message FROM OfflineMessage "
+										"WHERE userid = ? AND id > ? ORDER BY id LIMIT ?");
+		if (stmt != nullptr && stmt->param(userid).param(cursor).param(limit).execute())
 		{
-			MYSQL_ROW row;
-			while ((row = mysql_fetch_row(res)) != nullptr)
+			while (stmt->fetch())
 			{
-				vec.push_back(row[0]);
+				page.emplace_back(stmt->getInt(0), stmt->getString(1));
 			}
-
-			mysql_free_result(res);
 		}
 	}
-	return vec;
-}
\ No newline at end of file
+	return page;
+}
@@ -4,18 +4,14 @@
 
 bool UserModel::insert(User &user)
 {
-	// create sql statement
-	char sql[1024] = {0};
-	sprintf(sql, "INSERT INTO Users(name, password, state) VALUES ('%s', '%s', '%s')",
-			user.getName().c_str(), user.getPassword().c_str(), user.getState().c_str());
-
 	MySQL mysql;
 	if (mysql.connect())
 	{
-		if (mysql.update(sql))
+		Statement *stmt = mysql.prepare("INSERT INTO Users(name, password, state) VALUES(?, ?, ?)");
+		if (stmt != nullptr && stmt->param(user.getName()).param(user.getPassword()).param(user.getState()).execute())
 		{
 			// get user id
-			user.setId(mysql_insert_id(mysql.getConnection()));
+			user.setId(stmt->insertId());
 			return true;
 		}
 	}
@@ -25,28 +21,19 @@ bool UserModel::insert(User &user)
 
 User UserModel::query(int id)
 {
-	char sql[1024] = {0};
-	sprintf(sql, "SELECT * FROM Users WHERE id = %d", id);
-
 	MySQL mysql;
 
 	if (mysql.connect())
 	{
-		MYSQL_RES *res = mysql.query(sql);
-		if (res != nullptr)
+		Statement *stmt = mysql.prepare("SELECT id, name, password, state FROM Users WHERE id = ?");
+		if (stmt != nullptr && stmt->param(id).execute() && stmt->fetch())
 		{
-			MYSQL_ROW row = mysql_fetch_row(res);
-			if (row != nullptr)
-			{
-				User user;
-				user.setId(atoi(row[0]));
-				user.setName(row[1]);
-				user.setPassword(row[2]);
-				user.setState(row[3]);
-
-				mysql_free_result(res);
-				return user;
-			}
+			User user;
+			user.setId(stmt->getInt(0));
+			user.setName(stmt->getString(1));
+			user.setPassword(stmt->getString(2));
+			user.setState(stmt->getString(3));
+			return user;
 		}
 	}
 
@@ -55,13 +42,11 @@ User UserModel::query(int id)
 
 bool UserModel::updateState(const User &user)
 {
-	char sql[1024] = {0};
-	sprintf(sql, "UPDATE Users SET state = '%s' WHERE id = %d", user.getState().c_str(), user.getId());
-
 	MySQL mysql;
 	if (mysql.connect())
 	{
-		if (mysql.update(sql))
+		Statement *stmt = mysql.prepare("UPDATE Users SET state = ? WHERE id = ?");
+		if (stmt != nullptr && stmt->param(user.getState()).param(user.getId()).execute())
 		{
 			return true;
 		}
@@ -72,11 +57,9 @@ bool UserModel::updateState(const User &user)
 
 void UserModel::resetState()
 {
-	char sql[1024] = "UPDATE Users SET state = 'offline'";
-
 	MySQL mysql;
 	if (mysql.connect())
 	{
-		mysql.update(sql);
+		mysql.update("UPDATE Users SET state = 'offline'");
 	}
-}
\ No newline at end of file
+}
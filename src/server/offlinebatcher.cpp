@@ -0,0 +1,83 @@
+#include "offlinebatcher.hpp"
+#include "dbexecutor.hpp"
+
+#include <memory>
+
+// flush early once the pending messages reach this size, keeps a
+// multi-row INSERT well below max_allowed_packet
+static const size_t kMaxPendingBytes = 1024 * 1024;
+
+OfflineBatcher::OfflineBatcher(OfflineMsgModel &offlineModel, GroupModel &groupModel)
+	: _offlineModel(offlineModel), _groupModel(groupModel)
+{
+}
+
+void OfflineBatcher::setMaxRows(int maxRows)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_maxRows = maxRows;
+}
+
+void OfflineBatcher::add(int userid, const std::string &msg)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_pending.offline.emplace_back(userid, msg);
+	_pendingBytes += msg.size();
+	writeIfFull(lock);
+}
+
+void OfflineBatcher::addGroupMessage(int groupid, int userid, const std::string &msg)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_pending.group.push_back(GroupLogRow{groupid, userid, msg});
+	_pendingBytes += msg.size();
+	writeIfFull(lock);
+}
+
+void OfflineBatcher::flush()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	if (!_pending.offline.empty() || !_pending.group.empty())
+	{
+		write(takePending(), lock);
+	}
+}
+
+void OfflineBatcher::writeIfFull(std::unique_lock<std::mutex> &lock)
+{
+	if (_pending.offline.size() + _pending.group.size() >= _maxRows || _pendingBytes >= kMaxPendingBytes)
+	{
+		write(takePending(), lock);
+	}
+}
+
+OfflineBatcher::Batch OfflineBatcher::takePending()
+{
+	Batch batch;
+	batch.offline.swap(_pending.offline);
+	batch.group.swap(_pending.group);
+	_pendingBytes = 0;
+	return batch;
+}
+
+void OfflineBatcher::write(Batch batch, std::unique_lock<std::mutex> &lock)
+{
+	// hand over hand, the next batch cannot overtake this one, and adders do
+	// not wait while the rows go out, which is the INSERT itself without db loops
+	std::lock_guard<std::mutex> writeLock(_writeMutex);
+	lock.unlock();
+
+	// std::function needs a copyable task, share the rows instead of copying them
+	auto rows = std::make_shared<Batch>(std::move(batch));
+	DbExecutor::instance()->run(kWriterKey, [this, rows]()
+								{
+									if (!rows->offline.empty())
+									{
+										_offlineModel.insert(rows->offline);
+									}
+									if (!rows->group.empty())
+									{
+										_groupModel.insertMessages(rows->group);
+									}
+								});
+}
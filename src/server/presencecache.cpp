@@ -0,0 +1,93 @@
+#include "presencecache.hpp"
+
+#include <chrono>
+
+static const int64_t kMicroSecondsPerSecond = 1000 * 1000;
+
+PresenceCache::PresenceCache(int ttlSeconds)
+	: _ttl(ttlSeconds * kMicroSecondsPerSecond)
+{
+}
+
+void PresenceCache::setTtl(int ttlSeconds)
+{
+	_ttl = ttlSeconds * kMicroSecondsPerSecond;
+}
+
+void PresenceCache::setLocal(int userid, bool online)
+{
+	int64_t expireAt = now() + _ttl;
+	uint64_t version = ++_version;
+	_entries.update(userid, [online, expireAt, version](Entry &entry)
+					{
+						entry.version = version;
+						entry.online = online;
+						entry.node.clear();
+						entry.local = online;
+						// after logout the entry ages like a remote one
+						entry.expireAt = online ? INT64_MAX : expireAt;
+					});
+}
+
+void PresenceCache::setRemote(int userid, const std::string &node)
+{
+	int64_t expireAt = now() + _ttl;
+	uint64_t version = ++_version;
+	_entries.update(userid, [&node, expireAt, version](Entry &entry)
+					{
+						if (entry.local)
+						{
+							return;
+						}
+						entry.version = version;
+						entry.online = !node.empty();
+						entry.node = node;
+						entry.expireAt = expireAt;
+					});
+}
+
+uint64_t PresenceCache::readVersion() const
+{
+	return _version;
+}
+
+void PresenceCache::setRead(int userid, const std::string &node, uint64_t version)
+{
+	int64_t expireAt = now() + _ttl;
+	_entries.update(userid, [&node, expireAt, version](Entry &entry)
+					{
+						// a notification or local change landed while the read was in flight
+						if (entry.local || entry.version > version)
+						{
+							return;
+						}
+						entry.version = version;
+						entry.online = !node.empty();
+						entry.node = node;
+						entry.expireAt = expireAt;
+					});
+}
+
+PresenceCache::State PresenceCache::lookup(int userid, std::string &node) const
+{
+	Entry entry;
+	if (!_entries.find(userid, entry) || entry.expireAt <= now())
+	{
+		return UNKNOWN;
+	}
+	node = entry.node;
+	return entry.online ? ONLINE : OFFLINE;
+}
+
+size_t PresenceCache::evictExpired()
+{
+	int64_t current = now();
+	return _entries.eraseAll([current](int, const Entry &entry)
+							 { return entry.expireAt <= current; });
+}
+
+int64_t PresenceCache::now()
+{
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
@@ -1,7 +1,26 @@
 #include "redis.hpp"
+#include <cstring>
 #include <iostream>
 using namespace std;
 
+// channel shared by every server for presence changes, payload "userid:node", node empty when offline
+static const char *PRESENCE_CHANNEL = "presence";
+
+// prefix of the channel of a server node, payload "userid,userid,...:message"
+static const char *NODE_CHANNEL_PREFIX = "node:";
+
+// deletes the route only while it still belongs to the node asking, so a
+// late logout on the old node cannot remove the route of a new login
+static const char *REMOVE_ROUTE_SCRIPT =
+	"if redis.call('GET', KEYS[1]) == ARGV[1] then return redis.call('DEL', KEYS[1]) end return 0";
+
+// extends the route while it is missing or still belongs to the node asking,
+// so a refresh neither takes over the route of a login on another node nor
+// keeps a route lost to a redis restart missing
+static const char *REFRESH_ROUTE_SCRIPT =
+	"local v = redis.call('GET', KEYS[1]) "
+	"if v == false or v == ARGV[1] then redis.call('SET', KEYS[1], ARGV[1], 'EX', ARGV[2]) return 1 end return 0";
+
 Redis::Redis()
 	: _publish_context(nullptr), _subscribe_context(nullptr)
 {
@@ -38,6 +57,22 @@ bool Redis::connect()
 		return false;
 	}
 
+	// every server listens to presence changes of all users
+	if (REDIS_ERR == redisAppendCommand(_subscribe_context, "SUBSCRIBE %s", PRESENCE_CHANNEL))
+	{
+		cerr << "subscribe presence channel failed!" << endl;
+		return false;
+	}
+	int done = 0;
+	while (!done)
+	{
+		if (REDIS_ERR == redisBufferWrite(_subscribe_context, &done))
+		{
+			cerr << "subscribe presence channel failed!" << endl;
+			return false;
+		}
+	}
+
 	// In a separate thread, listen for events on the channel, and report any messages to the application layer
 	thread t([&]()
 			 { observer_channel_message(); });
@@ -48,61 +83,185 @@ bool Redis::connect()
 	return true;
 }
 
-// Publish a message to a specified channel in redis
-bool Redis::publish(int channel, string message)
+// Publish a message for users to the channel of the node they are on,
+// one copy of the message whatever the number of users
+int Redis::publishToNode(const string &node, const vector<int> &userids, const string &message)
 {
-	redisReply *reply = (redisReply *)redisCommand(_publish_context, "PUBLISH %d %s", channel, message.c_str());
+	string payload;
+	for (int userid : userids)
+	{
+		if (!payload.empty())
+		{
+			payload += ',';
+		}
+		payload += to_string(userid);
+	}
+	payload += ':';
+	payload += message;
+
+	lock_guard<mutex> lock(_publish_mutex);
+	redisReply *reply = (redisReply *)redisCommand(_publish_context, "PUBLISH %s%b %b", NODE_CHANNEL_PREFIX,
+												   node.data(), node.size(), payload.data(), payload.size());
 	if (nullptr == reply)
 	{
 		cerr << "publish command failed!" << endl;
+		return -1;
+	}
+	// PUBLISH replies with the number of subscribers that received the message
+	int receivers = reply->type == REDIS_REPLY_INTEGER ? static_cast<int>(reply->integer) : -1;
+	freeReplyObject(reply);
+	return receivers;
+}
+
+// Publish a presence change of a user to every server
+bool Redis::publishPresence(int userid, const string &node)
+{
+	lock_guard<mutex> lock(_publish_mutex);
+	redisReply *reply = (redisReply *)redisCommand(_publish_context, "PUBLISH %s %d:%b", PRESENCE_CHANNEL,
+												   userid, node.data(), node.size());
+	if (nullptr == reply)
+	{
+		cerr << "publish presence command failed!" << endl;
 		return false;
 	}
 	freeReplyObject(reply);
 	return true;
 }
 
-// Subscribe to a message on a specified channel in redis
-bool Redis::subscribe(int channel)
+bool Redis::setRoute(int userid, const string &node, int ttl)
 {
-	// The SUBSCRIBE command itself will cause the thread to block waiting for messages in the channel,
-	// here it only subscribes to the channel, and does not receive channel messages
-	// The reception of channel messages is done in a separate thread in the observer_channel_message function
-	// Only responsible for sending commands, not blocking to receive the response message from the redis server,
-	// otherwise it would compete with the notifyMsg thread for response resources
-	if (REDIS_ERR == redisAppendCommand(this->_subscribe_context, "SUBSCRIBE %d", channel))
+	lock_guard<mutex> lock(_publish_mutex);
+	redisReply *reply = (redisReply *)redisCommand(_publish_context, "SET route:%d %b EX %d",
+												   userid, node.data(), node.size(), ttl);
+	if (nullptr == reply)
 	{
-		cerr << "subscribe command failed!" << endl;
+		cerr << "set route command failed!" << endl;
 		return false;
 	}
-	// redisBufferWrite can cyclically send the buffer until the buffer data is sent (done is set to 1)
-	int done = 0;
-	while (!done)
+	bool ok = reply->type == REDIS_REPLY_STATUS;
+	freeReplyObject(reply);
+	return ok;
+}
+
+bool Redis::refreshRoutes(const vector<int> &userids, const string &node, int ttl)
+{
+	lock_guard<mutex> lock(_publish_mutex);
+	// pipelined, the commands go out together and the replies are read afterwards
+	for (int userid : userids)
 	{
-		if (REDIS_ERR == redisBufferWrite(this->_subscribe_context, &done))
+		if (REDIS_ERR == redisAppendCommand(_publish_context, "EVAL %s 1 route:%d %b %d",
+											REFRESH_ROUTE_SCRIPT, userid, node.data(), node.size(), ttl))
 		{
-			cerr << "subscribe command failed!" << endl;
+			cerr << "refresh route command failed!" << endl;
 			return false;
 		}
 	}
+	bool ok = true;
+	for (size_t i = 0; i < userids.size(); ++i)
+	{
+		redisReply *reply = nullptr;
+		if (REDIS_OK != redisGetReply(_publish_context, (void **)&reply))
+		{
+			// the context is unusable after a failed read
+			cerr << "refresh route command failed!" << endl;
+			return false;
+		}
+		ok = ok && reply->type == REDIS_REPLY_INTEGER;
+		freeReplyObject(reply);
+	}
+	return ok;
+}
 
-	return true;
+bool Redis::removeRoute(int userid, const string &node)
+{
+	lock_guard<mutex> lock(_publish_mutex);
+	redisReply *reply = (redisReply *)redisCommand(_publish_context, "EVAL %s 1 route:%d %b",
+												   REMOVE_ROUTE_SCRIPT, userid, node.data(), node.size());
+	if (nullptr == reply)
+	{
+		cerr << "remove route command failed!" << endl;
+		return false;
+	}
+	bool ok = reply->type == REDIS_REPLY_INTEGER;
+	freeReplyObject(reply);
+	return ok;
 }
 
-// Unsubscribe to a message on a specified channel in redis
-bool Redis::unsubscribe(int channel)
+bool Redis::getRoute(int userid, string &node)
 {
-	if (REDIS_ERR == redisAppendCommand(this->_subscribe_context, "UNSUBSCRIBE %d", channel))
+	lock_guard<mutex> lock(_publish_mutex);
+	redisReply *reply = (redisReply *)redisCommand(_publish_context, "GET route:%d", userid);
+	if (nullptr == reply)
 	{
-		cerr << "unsubscribe command failed!" << endl;
+		cerr << "get route command failed!" << endl;
+		return false;
+	}
+	bool ok = reply->type == REDIS_REPLY_STRING || reply->type == REDIS_REPLY_NIL;
+	node.assign(reply->type == REDIS_REPLY_STRING ? reply->str : "",
+				reply->type == REDIS_REPLY_STRING ? reply->len : 0);
+	freeReplyObject(reply);
+	return ok;
+}
+
+bool Redis::getRoutes(const vector<int> &userids, vector<string> &nodes)
+{
+	nodes.assign(userids.size(), string());
+	if (userids.empty())
+	{
+		return true;
+	}
+
+	vector<string> args;
+	args.reserve(userids.size() + 1);
+	args.push_back("MGET");
+	for (int userid : userids)
+	{
+		args.push_back("route:" + to_string(userid));
+	}
+	vector<const char *> argv;
+	vector<size_t> argvlen;
+	for (const string &arg : args)
+	{
+		argv.push_back(arg.data());
+		argvlen.push_back(arg.size());
+	}
+
+	lock_guard<mutex> lock(_publish_mutex);
+	redisReply *reply = (redisReply *)redisCommandArgv(_publish_context, static_cast<int>(argv.size()),
+														argv.data(), argvlen.data());
+	if (nullptr == reply)
+	{
+		cerr << "get routes command failed!" << endl;
+		return false;
+	}
+	bool ok = reply->type == REDIS_REPLY_ARRAY && reply->elements == userids.size();
+	for (size_t i = 0; ok && i < reply->elements; ++i)
+	{
+		if (reply->element[i]->type == REDIS_REPLY_STRING)
+		{
+			nodes[i].assign(reply->element[i]->str, reply->element[i]->len);
+		}
+	}
+	freeReplyObject(reply);
+	return ok;
+}
+
+// Subscribe to the channel of a server node
+bool Redis::subscribeNode(const string &node)
+{
+	lock_guard<mutex> lock(_subscribe_mutex);
+	if (REDIS_ERR == redisAppendCommand(this->_subscribe_context, "SUBSCRIBE %s%b", NODE_CHANNEL_PREFIX,
+										node.data(), node.size()))
+	{
+		cerr << "subscribe command failed!" << endl;
 		return false;
 	}
-	// redisBufferWrite can cyclically send the buffer until the buffer data is sent (done is set to 1)
 	int done = 0;
 	while (!done)
 	{
 		if (REDIS_ERR == redisBufferWrite(this->_subscribe_context, &done))
 		{
-			cerr << "unsubscribe command failed!" << endl;
+			cerr << "subscribe command failed!" << endl;
 			return false;
 		}
 	}
@@ -118,8 +277,37 @@ void Redis::observer_channel_message()
 		// The received subscription message is an array with three elements
 		if (reply != nullptr && reply->element[2] != nullptr && reply->element[2]->str != nullptr)
 		{
-			// Report the messages on the channel to the application layer
-			_notify_message_handler(atoi(reply->element[1]->str), reply->element[2]->str);
+			const char *channel = reply->element[1]->str;
+			const char *payload = reply->element[2]->str;
+			const char *separator = strchr(payload, ':');
+			if (strcmp(channel, PRESENCE_CHANNEL) == 0)
+			{
+				// "userid:node", node empty when the user went offline
+				if (separator != nullptr && _presence_handler)
+				{
+					_presence_handler(atoi(payload), separator + 1);
+				}
+			}
+			else if (strncmp(channel, NODE_CHANNEL_PREFIX, strlen(NODE_CHANNEL_PREFIX)) == 0)
+			{
+				// "userid,userid,...:message" routed to this node
+				if (separator != nullptr && _notify_message_handler)
+				{
+					vector<int> userids;
+					const char *id = payload;
+					while (id < separator)
+					{
+						userids.push_back(atoi(id));
+						const char *comma = strchr(id, ',');
+						if (comma == nullptr || comma > separator)
+						{
+							break;
+						}
+						id = comma + 1;
+					}
+					_notify_message_handler(move(userids), separator + 1);
+				}
+			}
 		}
 
 		freeReplyObject(reply);
@@ -128,7 +316,12 @@ void Redis::observer_channel_message()
 	cerr << ">>>>>>>>>>>>> observer_channel_message quit <<<<<<<<<<<<<" << endl;
 }
 
-void Redis::init_notify_handler(function<void(int, string)> fn)
+void Redis::init_notify_handler(function<void(vector<int>, string)> fn)
 {
 	this->_notify_message_handler = fn;
 }
+
+void Redis::init_presence_handler(function<void(int, string)> fn)
+{
+	this->_presence_handler = fn;
+}
\ No newline at end of file
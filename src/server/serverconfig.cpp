@@ -0,0 +1,289 @@
+#include "serverconfig.hpp"
+
+#include <getopt.h>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+static void usage(const char *prog)
+{
+	std::cerr << "usage: " << prog << " ip port [options]" << std::endl
+			  << "  --threads N|auto            io threads in total (default 4, auto = one per cpu)" << std::endl
+			  << "  --cpu-affinity              pin every io thread to its own cpu" << std::endl
+			  << "  --acceptors N               SO_REUSEPORT acceptors sharing the port (default 1)" << std::endl
+			  << "  --workers N                 business worker threads for handlers (default 4, 0 = run on io threads)" << std::endl
+			  << "  --idle-timeout SECONDS      close connections silent for this long (default 60, 0 = off)" << std::endl
+			  << "  --high-water-mark BYTES     output buffer limit per connection (default 4194304)" << std::endl
+			  << "  --backpressure spill|close  above the high water mark spill messages to offline storage" << std::endl
+			  << "                              or close the connection (default spill)" << std::endl
+			  << "  --node-id NAME              name of this server in the route table (default ip:port)" << std::endl
+			  << "  --route-ttl SECONDS         routes of a crashed server expire after this long (default 60)" << std::endl
+			  << "  --presence-ttl SECONDS      cache presence of remote users this long (default 30, 0 = off)" << std::endl
+			  << "  --offline-batch ROWS        offline messages per multi-row INSERT (default 256, 1 = write through)" << std::endl
+			  << "  --offline-flush-ms MS       longest wait of an offline message before it is written (default 50)" << std::endl
+			  << "  --offline-page N            offline messages per acked page (default 100)" << std::endl
+			  << "  --db-threads N              db loops running mysql calls (default 4, 0 = run inline)" << std::endl
+			  << "  --db-pool MIN:MAX           mysql connections kept open and upper bound (default 2:16)" << std::endl
+			  << "  --db-idle-timeout SECONDS   close idle mysql connections above MIN (default 300)" << std::endl
+			  << "  --log BASENAME              write logs asynchronously to BASENAME.*.log" << std::endl
+			  << "  --log-level LEVEL           trace, debug, info, warn or error (default info)" << std::endl
+			  << "  --trace-sample N            log one inbound message out of every N (default 0, off)" << std::endl
+			  << "example: " << prog << " 127.0.0.1 6000 --threads auto --acceptors 4" << std::endl;
+}
+
+// upper bounds of the integer options
+static const long kMaxThreads = 1024;
+static const long kMaxSeconds = 7 * 24 * 3600;
+static const long kMaxFlushMs = 60 * 1000;
+static const long kMaxRows = 64 * 1024;
+static const long kMaxConnections = 64 * 1024;
+
+// parse a non negative integer option up to max, false if the text is not one
+static bool parseCount(const char *text, int &value, long max)
+{
+	char *end = nullptr;
+	long n = strtol(text, &end, 10);
+	if (end == text || *end != '\0' || n < 0 || n > max)
+	{
+		return false;
+	}
+	value = static_cast<int>(n);
+	return true;
+}
+
+static bool parseLogLevel(const std::string &text, muduo::Logger::LogLevel &level)
+{
+	static const char *names[] = {"trace", "debug", "info", "warn", "error"};
+	for (int i = 0; i < 5; ++i)
+	{
+		if (text == names[i])
+		{
+			level = static_cast<muduo::Logger::LogLevel>(muduo::Logger::TRACE + i);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool parseServerConfig(int argc, char **argv, ServerConfig &config)
+{
+	enum
+	{
+		OPT_THREADS = 1000,
+		OPT_CPU_AFFINITY,
+		OPT_ACCEPTORS,
+		OPT_WORKERS,
+		OPT_IDLE_TIMEOUT,
+		OPT_HIGH_WATER_MARK,
+		OPT_BACKPRESSURE,
+		OPT_NODE_ID,
+		OPT_ROUTE_TTL,
+		OPT_PRESENCE_TTL,
+		OPT_OFFLINE_BATCH,
+		OPT_OFFLINE_FLUSH_MS,
+		OPT_OFFLINE_PAGE,
+		OPT_DB_THREADS,
+		OPT_DB_POOL,
+		OPT_DB_IDLE_TIMEOUT,
+		OPT_LOG,
+		OPT_LOG_LEVEL,
+		OPT_TRACE_SAMPLE,
+	};
+
+	static const struct option options[] = {
+		{"threads", required_argument, nullptr, OPT_THREADS},
+		{"cpu-affinity", no_argument, nullptr, OPT_CPU_AFFINITY},
+		{"acceptors", required_argument, nullptr, OPT_ACCEPTORS},
+		{"workers", required_argument, nullptr, OPT_WORKERS},
+		{"idle-timeout", required_argument, nullptr, OPT_IDLE_TIMEOUT},
+		{"high-water-mark", required_argument, nullptr, OPT_HIGH_WATER_MARK},
+		{"backpressure", required_argument, nullptr, OPT_BACKPRESSURE},
+		{"node-id", required_argument, nullptr, OPT_NODE_ID},
+		{"route-ttl", required_argument, nullptr, OPT_ROUTE_TTL},
+		{"presence-ttl", required_argument, nullptr, OPT_PRESENCE_TTL},
+		{"offline-batch", required_argument, nullptr, OPT_OFFLINE_BATCH},
+		{"offline-flush-ms", required_argument, nullptr, OPT_OFFLINE_FLUSH_MS},
+		{"offline-page", required_argument, nullptr, OPT_OFFLINE_PAGE},
+		{"db-threads", required_argument, nullptr, OPT_DB_THREADS},
+		{"db-pool", required_argument, nullptr, OPT_DB_POOL},
+		{"db-idle-timeout", required_argument, nullptr, OPT_DB_IDLE_TIMEOUT},
+		{"log", required_argument, nullptr, OPT_LOG},
+		{"log-level", required_argument, nullptr, OPT_LOG_LEVEL},
+		{"trace-sample", required_argument, nullptr, OPT_TRACE_SAMPLE},
+		{nullptr, 0, nullptr, 0}};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", options, nullptr)) != -1)
+	{
+		switch (opt)
+		{
+		case OPT_THREADS:
+			if (std::string(optarg) == "auto")
+			{
+				config.ioThreads = static_cast<int>(std::thread::hardware_concurrency());
+			}
+			else if (!parseCount(optarg, config.ioThreads, kMaxThreads))
+			{
+				usage(argv[0]);
+				return false;
+			}
+			break;
+		case OPT_CPU_AFFINITY:
+			config.cpuAffinity = true;
+			break;
+		case OPT_ACCEPTORS:
+			if (!parseCount(optarg, config.acceptors, kMaxThreads) || config.acceptors == 0)
+			{
+				usage(argv[0]);
+				return false;
+			}
+			break;
+		case OPT_WORKERS:
+			if (!parseCount(optarg, config.workerThreads, kMaxThreads))
+			{
+				usage(argv[0]);
+				return false;
+			}
+			break;
+		case OPT_IDLE_TIMEOUT:
+			if (!parseCount(optarg, config.idleTimeout, kMaxSeconds))
+			{
+				usage(argv[0]);
+				return false;
+			}
+			break;
+		case OPT_HIGH_WATER_MARK:
+		{
+			char *end = nullptr;
+			long bytes = strtol(optarg, &end, 10);
+			if (end == optarg || *end != '\0' || bytes <= 0 || bytes > INT32_MAX)
+			{
+				usage(argv[0]);
+				return false;
+			}
+			config.highWaterMark = static_cast<int>(bytes);
+			break;
+		}
+		case OPT_BACKPRESSURE:
+			if (std::string(optarg) == "spill")
+			{
+				config.backpressure = SPILL_TO_OFFLINE;
+			}
+			else if (std::string(optarg) == "close")
+			{
+				config.backpressure = CLOSE_CONNECTION;
+			}
+			else
+			{
+				usage(argv[0]);
+				return false;
+			}
+			break;
+		case OPT_NODE_ID:
+			config.nodeId = optarg;
+			break;
+		case OPT_ROUTE_TTL:
+			if (!parseCount(optarg, config.routeTtl, kMaxSeconds) || config.routeTtl == 0)
+			{
+				usage(argv[0]);
+				return false;
+			}
+			break;
+		case OPT_PRESENCE_TTL:
+			if (!parseCount(optarg, config.presenceTtl, kMaxSeconds))
+			{
+				usage(argv[0]);
+				return false;
+			}
+			break;
+		case OPT_OFFLINE_BATCH:
+			if (!parseCount(optarg, config.offlineBatch, kMaxRows) || config.offlineBatch == 0)
+			{
+				usage(argv[0]);
+				return false;
+			}
+			break;
+		case OPT_OFFLINE_FLUSH_MS:
+			if (!parseCount(optarg, config.offlineFlushMs, kMaxFlushMs) || config.offlineFlushMs == 0)
+			{
+				usage(argv[0]);
+				return false;
+			}
+			break;
+		case OPT_OFFLINE_PAGE:
+			if (!parseCount(optarg, config.offlinePageSize, kMaxRows) || config.offlinePageSize == 0)
+			{
+				usage(argv[0]);
+				return false;
+			}
+			break;
+		case OPT_DB_THREADS:
+			if (!parseCount(optarg, config.dbThreads, kMaxThreads))
+			{
+				usage(argv[0]);
+				return false;
+			}
+			break;
+		case OPT_DB_POOL:
+		{
+			std::string text = optarg;
+			size_t colon = text.find(':');
+			if (colon == std::string::npos ||
+				!parseCount(text.substr(0, colon).c_str(), config.dbPoolMin, kMaxConnections) ||
+				!parseCount(text.substr(colon + 1).c_str(), config.dbPoolMax, kMaxConnections) ||
+				config.dbPoolMax == 0 || config.dbPoolMin > config.dbPoolMax)
+			{
+				usage(argv[0]);
+				return false;
+			}
+			break;
+		}
+		case OPT_DB_IDLE_TIMEOUT:
+			if (!parseCount(optarg, config.dbIdleTimeout, kMaxSeconds))
+			{
+				usage(argv[0]);
+				return false;
+			}
+			break;
+		case OPT_LOG:
+			config.logFile = optarg;
+			break;
+		case OPT_LOG_LEVEL:
+			if (!parseLogLevel(optarg, config.logLevel))
+			{
+				usage(argv[0]);
+				return false;
+			}
+			break;
+		case OPT_TRACE_SAMPLE:
+		{
+			int sample = 0;
+			if (!parseCount(optarg, sample, INT32_MAX))
+			{
+				usage(argv[0]);
+				return false;
+			}
+			config.traceSample = sample;
+			break;
+		}
+		default:
+			usage(argv[0]);
+			return false;
+		}
+	}
+
+	// getopt moves the positional arguments behind the options
+	if (argc - optind < 2)
+	{
+		usage(argv[0]);
+		return false;
+	}
+	config.ip = argv[optind];
+	config.port = static_cast<uint16_t>(atoi(argv[optind + 1]));
+	if (config.nodeId.empty())
+	{
+		config.nodeId = config.ip + ":" + std::to_string(config.port);
+	}
+	return true;
+}
@@ -0,0 +1,43 @@
+#include "timingwheel.hpp"
+
+#include <muduo/base/Logging.h>
+
+TimingWheel::Entry::~Entry()
+{
+	TcpConnectionPtr conn = _conn.lock();
+	if (conn)
+	{
+		LOG_INFO << conn->name() << " idle timeout, closing";
+		conn->forceClose();
+	}
+}
+
+TimingWheel::TimingWheel(EventLoop *loop, int idleSeconds)
+	: _buckets(idleSeconds)
+{
+	_buckets.resize(idleSeconds);
+	loop->runEvery(1.0, std::bind(&TimingWheel::onTimer, this));
+}
+
+TimingWheel::WeakEntryPtr TimingWheel::add(const TcpConnectionPtr &conn)
+{
+	EntryPtr entry = std::make_shared<Entry>(conn);
+	_buckets.back().insert(entry);
+	return entry;
+}
+
+void TimingWheel::touch(const WeakEntryPtr &weakEntry)
+{
+	EntryPtr entry = weakEntry.lock();
+	if (entry)
+	{
+		_buckets.back().insert(entry);
+	}
+}
+
+// pushing a new bucket drops the oldest one, entries that were not touched
+// since then lose their last reference and close their connection
+void TimingWheel::onTimer()
+{
+	_buckets.push_back(Bucket());
+}
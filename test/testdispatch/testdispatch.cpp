@@ -0,0 +1,144 @@
+/**
+ * micro benchmark of message dispatch
+ * 1. old: std::unordered_map<int, std::function> lookup, then copy the handler out
+ * 2. new: constexpr std::array of member function pointers indexed by msgid
+ */
+#include "public.hpp"
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+struct Message
+{
+    int msgid;
+    long payload;
+};
+
+class Service;
+using MsgHandler = void (Service::*)(Message &);
+using MsgFunction = std::function<void(Message &)>;
+
+class Service
+{
+public:
+    Service()
+    {
+        using std::placeholders::_1;
+        _handlerMap.insert({LOGIN_MSG, std::bind(&Service::login, this, _1)});
+        _handlerMap.insert({REG_MSG, std::bind(&Service::reg, this, _1)});
+        _handlerMap.insert({LOGOUT_MSG, std::bind(&Service::logout, this, _1)});
+        _handlerMap.insert({ONE_CHAT_MSG, std::bind(&Service::oneChat, this, _1)});
+        _handlerMap.insert({ADD_FRIEND_MSG, std::bind(&Service::addFriend, this, _1)});
+        _handlerMap.insert({CREATE_GROUP_MSG, std::bind(&Service::createGroup, this, _1)});
+        _handlerMap.insert({ADD_GROUP_MSG, std::bind(&Service::addGroup, this, _1)});
+        _handlerMap.insert({GROUP_CHAT_MSG, std::bind(&Service::groupChat, this, _1)});
+    }
+
+    void login(Message &m) { _sum += m.payload; }
+    void reg(Message &m) { _sum += m.payload * 2; }
+    void logout(Message &m) { _sum -= m.payload; }
+    void oneChat(Message &m) { _sum ^= m.payload; }
+    void addFriend(Message &m) { _sum += 3; }
+    void createGroup(Message &m) { _sum += m.payload >> 1; }
+    void addGroup(Message &m) { _sum -= 7; }
+    void groupChat(Message &m) { _sum += m.payload | 1; }
+
+    // old path, same shape as ChatService::getHandler
+    MsgFunction getHandler(int msgid)
+    {
+        auto it = _handlerMap.find(msgid);
+        if (it == _handlerMap.end())
+        {
+            return [](Message &) {};
+        }
+        return _handlerMap[msgid];
+    }
+
+    // new path, same shape as ChatService::dispatch
+    void dispatch(Message &m);
+
+    long sum() const { return _sum; }
+
+private:
+    std::unordered_map<int, MsgFunction> _handlerMap;
+    long _sum = 0;
+};
+
+static constexpr std::array<MsgHandler, MSG_TYPE_COUNT> makeHandlerTable()
+{
+    std::array<MsgHandler, MSG_TYPE_COUNT> table{};
+    table[LOGIN_MSG] = &Service::login;
+    table[REG_MSG] = &Service::reg;
+    table[LOGOUT_MSG] = &Service::logout;
+    table[ONE_CHAT_MSG] = &Service::oneChat;
+    table[ADD_FRIEND_MSG] = &Service::addFriend;
+    table[CREATE_GROUP_MSG] = &Service::createGroup;
+    table[ADD_GROUP_MSG] = &Service::addGroup;
+    table[GROUP_CHAT_MSG] = &Service::groupChat;
+    return table;
+}
+
+static constexpr std::array<MsgHandler, MSG_TYPE_COUNT> handlerTable = makeHandlerTable();
+
+void Service::dispatch(Message &m)
+{
+    if (m.msgid <= 0 || m.msgid >= MSG_TYPE_COUNT || handlerTable[m.msgid] == nullptr)
+    {
+        return;
+    }
+    (this->*handlerTable[m.msgid])(m);
+}
+
+template <typename Func>
+double measure(const char *name, Func func, std::vector<Message> &msgs, int rounds)
+{
+    auto begin = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r)
+    {
+        for (Message &m : msgs)
+        {
+            func(m);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - begin).count() / (msgs.size() * rounds);
+    std::cout << name << ": " << ns << " ns/msg" << std::endl;
+    return ns;
+}
+
+int main()
+{
+    const int kMessages = 1 << 16;
+    const int kRounds = 200;
+    const int handled[] = {LOGIN_MSG, REG_MSG, LOGOUT_MSG, ONE_CHAT_MSG, ADD_FRIEND_MSG,
+                           CREATE_GROUP_MSG, ADD_GROUP_MSG, GROUP_CHAT_MSG};
+
+    std::mt19937 gen(2023);
+    std::uniform_int_distribution<int> pick(0, 7);
+    std::vector<Message> msgs(kMessages);
+    for (Message &m : msgs)
+    {
+        m.msgid = handled[pick(gen)];
+        m.payload = gen();
+    }
+
+    Service oldService;
+    Service newService;
+    double oldNs = measure("unordered_map + std::function copy", [&](Message &m)
+                           { oldService.getHandler(m.msgid)(m); }, msgs, kRounds);
+    double newNs = measure("constexpr member pointer table", [&](Message &m)
+                           { newService.dispatch(m); }, msgs, kRounds);
+
+    if (oldService.sum() != newService.sum())
+    {
+        std::cerr << "result mismatch!" << std::endl;
+        return 1;
+    }
+    std::cout << "speedup: " << oldNs / newNs << "x" << std::endl;
+    return 0;
+}
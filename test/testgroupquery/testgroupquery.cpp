@@ -0,0 +1,186 @@
+/**
+ * benchmark of loading the groups of a user with their members
+ * 1. old: one query for the groups, then one query per group for its members
+ * 2. new: the group and member rows of the login snapshot, one UNION ALL
+ * needs the chat database of the server, the fixture rows are removed at exit
+ */
+#include <mysql/mysql.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+const int kMembersPerGroup = 20;
+const int kRounds = 200;
+
+struct Member
+{
+    int id;
+    std::string name;
+    std::string state;
+    std::string role;
+};
+
+struct GroupRow
+{
+    int id;
+    std::string name;
+    std::string desc;
+    std::vector<Member> members;
+};
+
+static MYSQL *g_conn;
+
+static void exec(const std::string &sql)
+{
+    if (mysql_query(g_conn, sql.c_str()))
+    {
+        std::cerr << sql << ": " << mysql_error(g_conn) << std::endl;
+        exit(1);
+    }
+}
+
+static int insertUser(const std::string &name)
+{
+    exec("INSERT INTO Users(name, password, state) VALUES('" + name + "', 'bench', 'offline')");
+    return static_cast<int>(mysql_insert_id(g_conn));
+}
+
+std::vector<GroupRow> queryOld(int userid)
+{
+    std::vector<GroupRow> groups;
+    exec("SELECT a.id, a.groupname, a.groupdesc FROM AllGroup a INNER JOIN GroupUser b "
+         "ON a.id = b.groupid WHERE b.userid = " + std::to_string(userid));
+    MYSQL_RES *res = mysql_store_result(g_conn);
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(res)) != nullptr)
+    {
+        groups.push_back({atoi(row[0]), row[1], row[2] ? row[2] : "", {}});
+    }
+    mysql_free_result(res);
+
+    for (GroupRow &group : groups)
+    {
+        exec("SELECT a.id, a.name, a.state, b.grouprole FROM Users a INNER JOIN GroupUser b "
+             "ON b.userid = a.id WHERE b.groupid = " + std::to_string(group.id));
+        res = mysql_store_result(g_conn);
+        while ((row = mysql_fetch_row(res)) != nullptr)
+        {
+            group.members.push_back({atoi(row[0]), row[1], row[2], row[3]});
+        }
+        mysql_free_result(res);
+    }
+    return groups;
+}
+
+// the group and member parts of the login snapshot in LoginModel::load,
+// one UNION ALL whose rows are (kind, id, userid, text1, text2, text3)
+std::vector<GroupRow> queryNew(int userid)
+{
+    std::string id = std::to_string(userid);
+    std::vector<GroupRow> groups;
+    exec("SELECT 2, a.id, 0, a.groupname, a.groupdesc, NULL "
+         "FROM AllGroup a INNER JOIN GroupUser b ON a.id = b.groupid WHERE b.userid = " + id +
+         " UNION ALL SELECT 3, m.groupid, u.id, u.name, u.state, m.grouprole "
+         "FROM GroupUser b INNER JOIN GroupUser m ON m.groupid = b.groupid "
+         "INNER JOIN Users u ON u.id = m.userid WHERE b.userid = " + id);
+    MYSQL_RES *res = mysql_store_result(g_conn);
+
+    // rows of one kind may arrive in any order, members are attached at the end
+    std::unordered_map<int, std::vector<Member>> members;
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(res)) != nullptr)
+    {
+        if (atoi(row[0]) == 2)
+        {
+            groups.push_back({atoi(row[1]), row[3], row[4] ? row[4] : "", {}});
+        }
+        else
+        {
+            members[atoi(row[1])].push_back({atoi(row[2]), row[3], row[4], row[5]});
+        }
+    }
+    mysql_free_result(res);
+
+    for (GroupRow &group : groups)
+    {
+        group.members = std::move(members[group.id]);
+    }
+    return groups;
+}
+
+template <typename Query>
+double run(Query query, int userid, size_t &members)
+{
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < kRounds; ++i)
+    {
+        members = 0;
+        for (const GroupRow &group : query(userid))
+        {
+            members += group.members.size();
+        }
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - begin;
+    return elapsed.count() / kRounds;
+}
+
+int main()
+{
+    g_conn = mysql_init(nullptr);
+    if (mysql_real_connect(g_conn, "127.0.0.1", "root", "123456", "chat", 3306, nullptr, 0) == nullptr)
+    {
+        std::cerr << "connect mysql failed: " << mysql_error(g_conn) << std::endl;
+        return 1;
+    }
+
+    // the benchmarked user and the other members shared by every group
+    int userid = insertUser("groupbench");
+    std::vector<int> others;
+    for (int i = 1; i < kMembersPerGroup; ++i)
+    {
+        others.push_back(insertUser("groupbench" + std::to_string(i)));
+    }
+
+    std::vector<int> groupids;
+    std::cout << "groups  members  old(us)  new(us)" << std::endl;
+    for (int count : {1, 10, 50, 200})
+    {
+        while (static_cast<int>(groupids.size()) < count)
+        {
+            exec("INSERT INTO AllGroup(groupname, groupdesc) VALUES('groupbench" +
+                 std::to_string(groupids.size()) + "', 'benchmark')");
+            int groupid = static_cast<int>(mysql_insert_id(g_conn));
+            groupids.push_back(groupid);
+            exec("INSERT INTO GroupUser(groupid, userid, grouprole) VALUES(" + std::to_string(groupid) + ", " +
+                 std::to_string(userid) + ", 'creater')");
+            for (int other : others)
+            {
+                exec("INSERT INTO GroupUser(groupid, userid, grouprole) VALUES(" + std::to_string(groupid) + ", " +
+                     std::to_string(other) + ", 'normal')");
+            }
+        }
+
+        size_t oldMembers = 0;
+        size_t newMembers = 0;
+        double oldUs = run(queryOld, userid, oldMembers);
+        double newUs = run(queryNew, userid, newMembers);
+        if (oldMembers != newMembers)
+        {
+            std::cerr << "member count differs: " << oldMembers << " vs " << newMembers << std::endl;
+        }
+        std::cout << count << "\t" << newMembers << "\t " << oldUs << "\t  " << newUs << std::endl;
+    }
+
+    for (int groupid : groupids)
+    {
+        exec("DELETE FROM GroupUser WHERE groupid = " + std::to_string(groupid));
+        exec("DELETE FROM AllGroup WHERE id = " + std::to_string(groupid));
+    }
+    exec("DELETE FROM Users WHERE name LIKE 'groupbench%'");
+    mysql_close(g_conn);
+    return 0;
+}
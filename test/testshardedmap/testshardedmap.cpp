@@ -0,0 +1,104 @@
+/**
+ * benchmark of the online user registry lookup throughput
+ * 1. old: one std::mutex guarding std::unordered_map<int, shared_ptr>
+ * 2. new: ShardedMap with a shared_mutex per shard
+ * every thread looks up random online users, like oneChat/groupChat do
+ */
+#include "../../include/server/shardedmap.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// stands in for TcpConnectionPtr, copying it touches an atomic refcount
+using ConnPtr = std::shared_ptr<int>;
+
+class LockedMap
+{
+public:
+    void insert(int key, const ConnPtr &value)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _map.insert({key, value});
+    }
+
+    bool find(int key, ConnPtr &value)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _map.find(key);
+        if (it == _map.end())
+        {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+
+private:
+    std::mutex _mutex;
+    std::unordered_map<int, ConnPtr> _map;
+};
+
+const int kUsers = 100000;
+const int kLookupsPerThread = 2000000;
+
+template <typename Map>
+double run(Map &map, int threads)
+{
+    std::atomic<long> found{0};
+    std::vector<std::thread> pool;
+    auto begin = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; ++t)
+    {
+        pool.emplace_back([&map, &found, t]()
+                          {
+                              std::mt19937 gen(t);
+                              std::uniform_int_distribution<int> pick(0, 2 * kUsers);
+                              long hits = 0;
+                              ConnPtr conn;
+                              for (int i = 0; i < kLookupsPerThread; ++i)
+                              {
+                                  if (map.find(pick(gen), conn))
+                                  {
+                                      ++hits;
+                                  }
+                              }
+                              found += hits;
+                          });
+    }
+    for (std::thread &th : pool)
+    {
+        th.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - begin).count();
+    return threads * static_cast<double>(kLookupsPerThread) / seconds / 1e6;
+}
+
+int main()
+{
+    LockedMap locked;
+    ShardedMap<int, ConnPtr> sharded;
+    for (int id = 0; id < kUsers; ++id)
+    {
+        ConnPtr conn = std::make_shared<int>(id);
+        locked.insert(id, conn);
+        sharded.insert(id, conn);
+    }
+
+    std::cout << "hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << "threads\tmutex+map Mops/s\tsharded Mops/s" << std::endl;
+    for (int threads = 1; threads <= 16; threads *= 2)
+    {
+        double lockedRate = run(locked, threads);
+        double shardedRate = run(sharded, threads);
+        std::cout << threads << "\t" << lockedRate << "\t\t\t" << shardedRate << std::endl;
+    }
+    return 0;
+}